@@ -0,0 +1,148 @@
+#include <assert.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "freq.h"
+#include "util.h"
+
+/*
+Compare the autocorrelation engines at the lengths the tuner actually runs.
+main.c uses ACLEN = 2048 with the 1024-sample period the Pi's capture device
+insists on; the longer lag ranges are what we'd need to go lower in the bass.
+
+GFLOP/s is counted as the 2*nac*ndp multiply-adds of the direct method for
+every engine, so for the FFT engine it's an "effective" rate that can be
+compared straight across.
+
+"fixed" is the int16 kernel, run on the same signal rounded to int16. Its time
+includes turning the integer sums into means, but not the rounding, since with
+--fixed the tuner's history is int16 already.
+*/
+
+#define PERIOD 1024
+#define RATE 48000
+#define MIN_TIME 0.5
+
+typedef void (*Engine)(float *f, unsigned nf, float *ac, unsigned nac);
+
+// The int16 copy of the signal and the sums, for autocorrelate_fixed().
+static int16_t *fixed_f;
+static int64_t *fixed_sums;
+
+
+static void autocorrelate_fixed(float *f, unsigned nf, float *ac, unsigned nac)
+{
+    memset(fixed_sums, 0, nac*sizeof(int64_t));
+    autocorrelate_s16_lags(fixed_f, nf, fixed_sums, nac, 0, nac);
+    float scale = 1.f / (nf - nac);
+    for (unsigned i = 0; i < nac; i++)
+        ac[i] += fixed_sums[i]*scale;
+}
+
+static const struct
+{
+    const char *name;
+    Engine engine;
+} engines[] = {
+    {"dot",  autocorrelate_dot},
+    {"fft",  autocorrelate_fft},
+    {"simd", autocorrelate_simd},
+    {"parallel", autocorrelate_parallel},
+    {"fixed", autocorrelate_fixed},
+};
+
+
+static void make_signal(float *f, unsigned nf)
+{
+    // A low A with a couple of partials and some hiss, at S16-ish amplitude.
+    const float f0 = 110;
+    for (unsigned i = 0; i < nf; i++)
+    {
+        float t = (float)i / RATE;
+        f[i] = 3000*sinf(2*M_PI*f0*t)
+             + 1500*sinf(2*M_PI*2*f0*t)
+             +  700*sinf(2*M_PI*3*f0*t)
+             + 200*((float)random()/RAND_MAX - 0.5f);
+    }
+}
+
+
+// Returns the mean time per call in seconds.
+static double time_engine(Engine e, float *f, unsigned nf, float *ac, unsigned nac)
+{
+    unsigned calls = 0;
+    double start = monotonic(), elapsed;
+    do
+    {
+        e(f, nf, ac, nac);
+        calls++;
+        elapsed = monotonic() - start;
+    } while (elapsed < MIN_TIME);
+    return elapsed / calls;
+}
+
+
+int main(int argc, const char **argv)
+{
+    const unsigned aclens[] = {1024, 2048, 4096, 8192};
+
+    // Optionally, the parallel engine's thread count; default one per CPU.
+    unsigned threads = 0;
+    if (argc > 1)
+        assert(sscanf(argv[1], "%u", &threads) == 1);
+    autocorrelate_threads(threads);
+
+    printf("%6s %6s %8s %10s %8s %8s %10s\n",
+           "nac", "nf", "engine", "time (us)", "GFLOP/s", "speedup", "max err");
+
+    for (unsigned a = 0; a < SALEN(aclens); a++)
+    {
+        unsigned nac = aclens[a], nf = nac + PERIOD;
+        float *f = malloc(nf*sizeof(float)),
+              *ref = calloc(nac, sizeof(float)),
+              *ac = malloc(nac*sizeof(float));
+        fixed_f = malloc(nf*sizeof(int16_t));
+        fixed_sums = malloc(nac*sizeof(int64_t));
+        assert(f && ref && ac && fixed_f && fixed_sums);
+        make_signal(f, nf);
+        for (unsigned i = 0; i < nf; i++)
+            fixed_f[i] = lrintf(f[i]);
+
+        // Plan outside of the timed region, as main() does.
+        autocorrelate_plan(nf, nac);
+        autocorrelate_dot(f, nf, ref, nac);
+
+        double flops = 2. * nac * (nf - nac), t_dot = 0;
+        for (unsigned e = 0; e < SALEN(engines); e++)
+        {
+            // One clean call for the accuracy comparison against BLAS
+            memset(ac, 0, nac*sizeof(float));
+            engines[e].engine(f, nf, ac, nac);
+            float err = 0;
+            for (unsigned i = 0; i < nac; i++)
+                err = fmaxf(err, fabsf(ac[i] - ref[i]));
+            err /= ref[0];
+
+            double t = time_engine(engines[e].engine, f, nf, ac, nac);
+            if (e == 0)
+                t_dot = t;
+
+            printf("%6u %6u %8s %10.1f %8.2f %8.1f %10.2e\n",
+                   nac, nf, engines[e].name, t*1e6, flops/t*1e-9, t_dot/t,
+                   err);
+        }
+        putchar('\n');
+
+        free(f);
+        free(ref);
+        free(ac);
+        free(fixed_f);
+        free(fixed_sums);
+    }
+
+    autocorrelate_deinit();
+    return 0;
+}
@@ -0,0 +1,362 @@
+#include <assert.h>
+#include <float.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bank.h"
+#include "freq.h"
+
+/*
+The spectral engine's readings without the FFT. spectrum.c transforms the whole
+window every update, only to look at the few bins around each partial; here,
+only those bins are kept, and kept up to date sample by sample as a sliding
+DFT:
+
+X_k(t) = e^(j*2*pi*k/n) * (X_k(t - 1) + x(t) - x(t - n))
+
+which is a complex multiply-add per bin per sample, whatever n is. Each partial
+gets a block of BANK_BINS + 2 adjacent bins, and the Hann window is applied to
+them afterwards, in frequency, as -1/4, 1/2, -1/4 across neighbours; that's
+where the + 2 goes. Peaks are then found and interpolated as in spectrum.c,
+over the same n-point window at the same bands, so the readings are the same.
+
+When a note starts, the blocks are computed from the history with the
+Goertzel algorithm, O(n) per bin. Each is centred where its partial is likely
+to be: on the harmonic for the first two, and for the rest, stretched from the
+second as a string's partials are. Whenever a block's peak is on its edge, the
+block moves along to centre it, within the harmonic's band, until the peak is
+inside it. Bins that the block keeps are kept; new ones are computed with
+Goertzel too.
+
+The bins' states are in structure-of-arrays form, all partials' blocks end to
+end, so that the per-sample update is one loop over independent bins that the
+compiler vectorises. They're doubles, because each is a sum over the whole
+window that's added to and subtracted from for as long as the note lasts.
+*/
+
+// Windowed bins per partial, and the raw ones it takes to window them.
+#define BANK_BINS 8
+#define RAW_BINS (BANK_BINS + 2)
+#define N_BINS (SPECTRUM_HARMONICS*RAW_BINS)
+// The most a partial's block moves per update, in case it never settles.
+#define BANK_MOVES 16
+
+
+struct BankTag
+{
+    unsigned rate, n;
+    // Whether the bins are up to date, or have to be computed afresh.
+    bool primed;
+
+    // The key's frequency, each harmonic's band of bins, [lo, hi), and the
+    // first raw bin of each partial's block.
+    float f;
+    unsigned lo[SPECTRUM_HARMONICS], hi[SPECTRUM_HARMONICS];
+    unsigned first[SPECTRUM_HARMONICS];
+
+    // Per raw bin: its state, and e^(j*2*pi*k/n).
+    double *re, *im, *c, *s;
+
+    Partial partials[SPECTRUM_HARMONICS];
+};
+
+
+Bank *bank_create(unsigned rate)
+{
+    Bank *b = malloc(sizeof(Bank));
+    assert(b);
+
+    b->rate = rate;
+    b->n = spectrum_size(rate);
+    b->re = malloc(N_BINS*sizeof(double));
+    b->im = malloc(N_BINS*sizeof(double));
+    b->c = malloc(N_BINS*sizeof(double));
+    b->s = malloc(N_BINS*sizeof(double));
+    assert(b->re && b->im && b->c && b->s);
+
+    b->f = 0;
+    b->primed = false;
+    return b;
+}
+
+
+void bank_destroy(Bank **b)
+{
+    free((*b)->re);
+    free((*b)->im);
+    free((*b)->c);
+    free((*b)->s);
+    free(*b);
+    *b = NULL;
+}
+
+
+// How many samples of history every update looks at, besides the new ones.
+unsigned bank_length(const Bank *b)
+{
+    return b->n;
+}
+
+
+// Start again from the history at the next update, e.g. for a new note.
+void bank_reset(Bank *b)
+{
+    b->primed = false;
+}
+
+
+/*
+Look for the harmonics of the given key, 0 for A0 up to N_NOTES - 1. The
+blocks are placed at the next update.
+*/
+void bank_set_note(Bank *b, unsigned key)
+{
+    assert(key < N_NOTES);
+    b->f = freq_of_key(key);
+    spectrum_bands(b->rate, b->n, b->f, b->lo, b->hi);
+
+    for (unsigned h = 0; h < SPECTRUM_HARMONICS; h++)
+        b->partials[h] = (Partial){.freq = -1, .cents = NAN, .magnitude = 0};
+    b->primed = false;
+}
+
+
+// Where partial h's block would start to put raw bin k at its middle.
+static unsigned block_at(const Bank *b, unsigned h, int k)
+{
+    int first = k - RAW_BINS/2;
+    if (first + RAW_BINS > (int)b->hi[h] + 1)
+        first = (int)b->hi[h] + 1 - RAW_BINS;
+    if (first < (int)b->lo[h] - 1)
+        first = (int)b->lo[h] - 1;
+    return first;
+}
+
+
+// Centre partial h's block on frequency f, without computing it.
+static void place(Bank *b, unsigned h, float f)
+{
+    b->first[h] = block_at(b, h, lrintf(f*b->n/b->rate));
+}
+
+
+static inline double sample(const void *x, VRBFormat format, size_t i)
+{
+    return format == VRB_S16 ? ((const int16_t*)x)[i] : ((const float*)x)[i];
+}
+
+
+/*
+Compute count raw bins from i on, which are bins k on, afresh from the n
+samples at x: Goertzel's recurrence, run for all of them at once, then the
+phase it leaves out. See slide() for which sum of x that's meant to be.
+*/
+static void goertzel(
+    Bank *b, unsigned i, unsigned k, unsigned count, const void *x,
+    VRBFormat format
+)
+{
+    assert(count <= RAW_BINS);
+    double coeff[RAW_BINS], s1[RAW_BINS] = {0}, s2[RAW_BINS] = {0};
+    for (unsigned j = 0; j < count; j++)
+    {
+        double w = 2*M_PI*(k + j)/b->n;
+        b->c[i + j] = cos(w);
+        b->s[i + j] = sin(w);
+        coeff[j] = 2*b->c[i + j];
+    }
+
+    for (unsigned m = 0; m < b->n; m++)
+    {
+        double v = sample(x, format, m);
+        for (unsigned j = 0; j < count; j++)
+        {
+            double s0 = v + coeff[j]*s1[j] - s2[j];
+            s2[j] = s1[j];
+            s1[j] = s0;
+        }
+    }
+
+    for (unsigned j = 0; j < count; j++)
+    {
+        // y = s1 - e^(-jw)*s2 is X_k*e^(-jw).
+        double c = b->c[i + j], s = b->s[i + j],
+               yr = s1[j] - c*s2[j], yi = s*s2[j];
+        b->re[i + j] = yr*c - yi*s;
+        b->im[i + j] = yr*s + yi*c;
+    }
+}
+
+
+/*
+Move partial h's block to start at raw bin first, keeping the bins that it
+still covers and computing the rest from the n samples at x.
+*/
+static void move(Bank *b, unsigned h, unsigned first, const void *x,
+                 VRBFormat format)
+{
+    unsigned base = h*RAW_BINS, old = b->first[h];
+    double *arrays[] = {b->re, b->im, b->c, b->s};
+    if (first > old && first < old + RAW_BINS)
+        for (unsigned a = 0; a < 4; a++)
+            memmove(
+                arrays[a] + base, arrays[a] + base + first - old,
+                (RAW_BINS - (first - old))*sizeof(double)
+            );
+    else if (first < old && old < first + RAW_BINS)
+        for (unsigned a = 0; a < 4; a++)
+            memmove(
+                arrays[a] + base + old - first, arrays[a] + base,
+                (RAW_BINS - (old - first))*sizeof(double)
+            );
+
+    // The new bins are a run at one end, or the whole block.
+    unsigned lo = 0, hi = RAW_BINS;
+    if (first > old && first < old + RAW_BINS)
+        lo = old + RAW_BINS - first;
+    else if (first < old && old < first + RAW_BINS)
+        hi = old - first;
+    goertzel(b, base + lo, first + lo, hi - lo, x, format);
+    b->first[h] = first;
+}
+
+
+/*
+Slide every bin along by the samples at x + n, n_new of them, each replacing
+the one n before it. Bin k's state is the DFT of the window as of the newest
+sample, the oldest first:
+
+X_k = sum over m from 0 to n - 1 of x(m)*e^(-j*2*pi*k*m/n)
+
+Each new sample moves every bin on by one: add the new sample and take away
+the one falling out of the window, then rotate by the bin's twiddle, c + j*s,
+one complex multiply per bin per sample. That's a loop over the bins inside a
+loop over the samples, so that the bins are what's vectorised.
+*/
+static void slide(Bank *b, const void *x, VRBFormat format, unsigned n_new)
+{
+    double *restrict re = b->re, *restrict im = b->im;
+    const double *restrict c = b->c, *restrict s = b->s;
+    for (unsigned t = 0; t < n_new; t++)
+    {
+        double d = sample(x, format, b->n + t) - sample(x, format, t);
+        for (unsigned i = 0; i < N_BINS; i++)
+        {
+            double a = re[i] + d;
+            re[i] = a*c[i] - im[i]*s[i];
+            im[i] = a*s[i] + im[i]*c[i];
+        }
+    }
+}
+
+
+// Power of partial h's windowed bin j, from raw bins j to j + 2.
+static double power(const Bank *b, unsigned h, unsigned j)
+{
+    unsigned i = h*RAW_BINS + j;
+    double re = 0.5*b->re[i + 1] - 0.25*(b->re[i] + b->re[i + 2]),
+           im = 0.5*b->im[i + 1] - 0.25*(b->im[i] + b->im[i + 2]);
+    return re*re + im*im;
+}
+
+
+// The strongest windowed bin of partial h's block.
+static unsigned strongest(const Bank *b, unsigned h)
+{
+    unsigned best = 0;
+    for (unsigned j = 1; j < BANK_BINS; j++)
+        if (power(b, h, j) > power(b, h, best))
+            best = j;
+    return best;
+}
+
+
+// Partial h's peak, placed between bins as in spectrum.c.
+static Partial peak(const Bank *b, unsigned h, unsigned j)
+{
+    double best_power = power(b, h, j);
+    if (!(best_power > 0) || j == 0 || j == BANK_BINS - 1)
+        return (Partial){.freq = -1, .cents = NAN, .magnitude = 0};
+
+    float a = logf(power(b, h, j - 1) + FLT_MIN),
+          m = logf(best_power),
+          c = logf(power(b, h, j + 1) + FLT_MIN),
+          curve = a - 2*m + c,
+          delta = curve < 0 ? 0.5f*(a - c)/curve : 0;
+
+    // Windowed bin j is raw bin j + 1.
+    float f = (b->first[h] + 1 + j + delta) * b->rate / b->n;
+    return (Partial){
+        .freq = f,
+        .cents = 1200*log2f(f / ((h + 1)*b->f)),
+        .magnitude = sqrtf(best_power),
+    };
+}
+
+
+/*
+Take the n_new samples just read into hist, which holds samples in the given
+format and reaches back bank_length() before them, and find every harmonic's
+peak as of the last of them.
+*/
+void bank_update(Bank *b, VRB *hist, VRBFormat format, unsigned n_new)
+{
+    assert(b->f > 0);
+    size_t size = vrb_format_size(format);
+    const void *x = vrb_past(hist, (b->n + n_new)*size);
+    // The window as of the newest sample
+    const void *window = (const uint8_t*)x + n_new*size;
+
+    bool priming = !b->primed;
+    if (b->primed)
+        slide(b, x, format, n_new);
+    b->primed = true;
+
+    for (unsigned h = 0; h < SPECTRUM_HARMONICS; h++)
+    {
+        /*
+        When starting again, every block is computed afresh anyway, so it may
+        as well start where the partial's likely to be. The stretch of a
+        string's partials goes as n^2 - 1 cents, so once the second has been
+        found, the others can be placed from it.
+        */
+        if (priming)
+        {
+            float cents = 0;
+            if (h >= 2 && b->partials[1].freq > 0)
+                cents = b->partials[1].cents * ((h + 1)*(h + 1) - 1) / 3;
+            place(b, h, (h + 1)*b->f*exp2f(cents/1200));
+            goertzel(b, h*RAW_BINS, b->first[h], RAW_BINS, window, format);
+        }
+
+        unsigned j = strongest(b, h);
+        for (unsigned moves = 0; moves < BANK_MOVES; moves++)
+        {
+            if (j != 0 && j != BANK_BINS - 1)
+                break;
+            // Bring the peak to the middle, staying inside the band.
+            unsigned first = block_at(b, h, b->first[h] + 1 + j);
+            if (first == b->first[h])
+                break;
+            move(b, h, first, window, format);
+            j = strongest(b, h);
+        }
+        b->partials[h] = peak(b, h, j);
+    }
+}
+
+
+// Each harmonic's peak as of the last update, the fundamental first.
+const Partial *bank_partials(const Bank *b)
+{
+    return b->partials;
+}
+
+
+// The fundamental as of the last update; see partials_freq().
+float bank_freq(const Bank *b)
+{
+    return partials_freq(b->partials);
+}
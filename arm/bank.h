@@ -0,0 +1,19 @@
+#pragma once
+
+#include "spectrum.h"
+#include "vrb.h"
+
+
+struct BankTag;
+typedef struct BankTag Bank;
+
+
+Bank *bank_create(unsigned rate);
+void bank_destroy(Bank **b);
+
+unsigned bank_length(const Bank *b);
+void bank_set_note(Bank *b, unsigned key);
+void bank_reset(Bank *b);
+void bank_update(Bank *b, VRB *hist, VRBFormat format, unsigned n);
+const Partial *bank_partials(const Bank *b);
+float bank_freq(const Bank *b);
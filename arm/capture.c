@@ -3,10 +3,14 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <asoundlib.h>
 
 #include "capture.h"
+#include "prof.h"
+#include "reactor.h"
+#include "replay.h"
 
 
 #define EXCRUCIATING_DETAIL 0
@@ -17,6 +21,10 @@
 // Has no effect?
 #define VOLUME 0.75
 
+// What the Pi ends up with, so that replays see the same blocks as it would.
+#define REPLAY_PERIOD 1024
+#define REPLAY_RAW_RATE 48000
+
 
 struct CaptureContextTag
 {
@@ -26,6 +34,14 @@ struct CaptureContextTag
     unsigned rate, timeout_ms, timeout_us, period;
     bool restart;
     snd_pcm_state_t prev_state;
+
+    // Waits on the PCM's poll descriptors, whose revents the handler fills in.
+    Reactor *reactor;
+    struct pollfd *pfds;
+    unsigned n_pfds;
+
+    // Non-null when replaying a file instead of using ALSA at all.
+    Replay *replay;
 };
 
 
@@ -536,11 +552,90 @@ static void describe_params(const CaptureContext *restrict ctx)
 }
 
 
-CaptureContext *capture_init(void)
+/*
+Fill in whatever wasn't given on the command line from the environment:
+PIANOTUNER_REPLAY names a file to replay, PIANOTUNER_FAST replays it as fast as
+possible if set to anything but 0, and PIANOTUNER_RATE is the rate of raw files.
+*/
+static CaptureOptions resolve_options(const CaptureOptions *given)
+{
+    CaptureOptions opts = {.replay = NULL, .fast = false, .raw_rate = 0};
+    if (given)
+        opts = *given;
+
+    const char *env;
+    if (!opts.replay)
+        opts.replay = getenv("PIANOTUNER_REPLAY");
+    if (!opts.fast && (env = getenv("PIANOTUNER_FAST")))
+        opts.fast = strcmp(env, "0") != 0;
+    if (!opts.raw_rate && (env = getenv("PIANOTUNER_RATE")))
+        opts.raw_rate = strtoul(env, NULL, 10);
+    if (!opts.raw_rate)
+        opts.raw_rate = REPLAY_RAW_RATE;
+    return opts;
+}
+
+
+static bool on_pcm(int fd, uint32_t events, void *arg)
+{
+    CaptureContext *ctx = arg;
+    for (unsigned i = 0; i < ctx->n_pfds; i++)
+        if (ctx->pfds[i].fd == fd)
+            ctx->pfds[i].revents = events;
+    return true;
+}
+
+
+/*
+Put the PCM's poll descriptors in a reactor of our own. They're level-triggered,
+as poll() would be: some plugins (dsnoop, and ioplugs on a pipe or eventfd)
+keep their descriptor readable until it's drained, and edge-triggered, those
+would only ever wake us on the timeout. snd_pcm_poll_descriptors_revents() then
+says what the wakeup meant, and capture_wait() checks what's available before
+every wait in any case.
+*/
+static void watch_pcm(CaptureContext *ctx)
+{
+    int n = snd_pcm_poll_descriptors_count(ctx->pcm);
+    check_snd(n);
+    assert(n > 0);
+    ctx->n_pfds = n;
+    ctx->pfds = malloc(n*sizeof(struct pollfd));
+    assert(ctx->pfds);
+    check_snd(snd_pcm_poll_descriptors(ctx->pcm, ctx->pfds, n));
+
+    ctx->reactor = reactor_create();
+    for (int i = 0; i < n; i++)
+    {
+        // poll() and epoll share event bits.
+        reactor_add(
+            ctx->reactor, ctx->pfds[i].fd, ctx->pfds[i].events,
+            on_pcm, ctx
+        );
+    }
+}
+
+
+/*
+Open the sound card, or a recording if one is given in opts (which may be
+null) or the environment.
+*/
+CaptureContext *capture_init(const CaptureOptions *opts)
 {
     CaptureContext *ctx = malloc(sizeof(CaptureContext));
     assert(ctx);
 
+    CaptureOptions o = resolve_options(opts);
+    if (o.replay)
+    {
+        ctx->replay = replay_open(o.replay, o.fast, o.raw_rate, REPLAY_PERIOD);
+        ctx->rate = replay_rate(ctx->replay);
+        ctx->period = REPLAY_PERIOD;
+        return ctx;
+    }
+    ctx->replay = NULL;
+    ctx->reactor = NULL;
+
     ctx->restart = false;
     ctx->prev_state = -1;  // The first state will always be "new"
 
@@ -563,6 +658,7 @@ CaptureContext *capture_init(void)
 
     init_pcm(ctx);
     describe_params(ctx);
+    watch_pcm(ctx);
     check_snd(snd_pcm_start(ctx->pcm));
 
     return ctx;
@@ -571,8 +667,15 @@ CaptureContext *capture_init(void)
 
 void capture_deinit(CaptureContext **ctx)
 {
-    warn_snd(snd_pcm_close((*ctx)->pcm));
-    snd_config_update_free_global();
+    if ((*ctx)->replay)
+        replay_close(&(*ctx)->replay);
+    else
+    {
+        reactor_destroy(&(*ctx)->reactor);
+        free((*ctx)->pfds);
+        warn_snd(snd_pcm_close((*ctx)->pcm));
+        snd_config_update_free_global();
+    }
 
     free(*ctx);
     *ctx = NULL;
@@ -587,6 +690,40 @@ shown in alsa-lib's test/pcm.c
 */
 
 
+/*
+Wait up to timeout_ms for the PCM's next event. This replaces both
+snd_pcm_wait() and the sleeps that used to back off after errors: either way,
+it's woken by the PCM itself as soon as there's something to do, and only
+waits out the timeout if there isn't. Returns 0 for data or a timeout, and a
+negative error code like snd_pcm_wait()'s if the PCM is in trouble.
+*/
+static int wait_pcm(const CaptureContext *restrict ctx, int timeout_ms)
+{
+    for (unsigned i = 0; i < ctx->n_pfds; i++)
+        ctx->pfds[i].revents = 0;
+    reactor_run(ctx->reactor, timeout_ms);
+
+    unsigned short revents;
+    int err = snd_pcm_poll_descriptors_revents(
+        ctx->pcm, ctx->pfds, ctx->n_pfds, &revents
+    );
+    if (err < 0)
+        return err;
+    if (!(revents & (POLLERR | POLLNVAL)))
+        return 0;
+
+    switch (snd_pcm_state(ctx->pcm))
+    {
+        case SND_PCM_STATE_XRUN:
+            return -EPIPE;
+        case SND_PCM_STATE_SUSPENDED:
+            return -ESTRPIPE;
+        default:
+            return -EIO;
+    }
+}
+
+
 static bool resume(const CaptureContext *restrict ctx)
 {
     fputs("Attempting to resume...\n", stderr);
@@ -597,7 +734,7 @@ static bool resume(const CaptureContext *restrict ctx)
         err = snd_pcm_resume(ctx->pcm);
         if (err != -EAGAIN)
             break;
-        sleep(1);
+        wait_pcm(ctx, 1000);
     }
 
     if (err == 0)
@@ -707,7 +844,7 @@ static snd_pcm_sframes_t capture_wait(CaptureContext *restrict ctx)
     snd_pcm_state_t state = snd_pcm_state(ctx->pcm);
     if (!recover_state(ctx, state))
     {
-        usleep(ctx->timeout_us);
+        wait_pcm(ctx, ctx->timeout_ms);
         return 0;
     }
 
@@ -716,7 +853,7 @@ static snd_pcm_sframes_t capture_wait(CaptureContext *restrict ctx)
     {
         ctx->restart = true;
         if (!recover_err(ctx, avail))
-            usleep(ctx->timeout_us);
+            wait_pcm(ctx, ctx->timeout_ms);
         return 0;
     }
 
@@ -732,78 +869,94 @@ static snd_pcm_sframes_t capture_wait(CaptureContext *restrict ctx)
         else
         {
             warn_snd(err);
-            usleep(ctx->timeout_us);
+            wait_pcm(ctx, ctx->timeout_ms);
         }
     }
     else
     {
-        int err = snd_pcm_wait(ctx->pcm, ctx->timeout_ms);
+        int err = wait_pcm(ctx, ctx->timeout_ms);
         if (err < 0)
         {
             ctx->restart = true;
             if (!recover_err(ctx, err))
-                usleep(ctx->timeout_us);
+                wait_pcm(ctx, ctx->timeout_ms);
         }
     }
     return 0;
 }
 
 
-void capture_do_capture(
+/*
+Wait for at least a period to be captured, then drain everything that's
+available, not just the one period: if the caller fell behind, it catches up
+in one call rather than one wait per period. Where the available frames wrap
+around the end of the mmap area, consume() is called once for each contiguous
+part. Returns the number of frames delivered, which for a replay is always a
+period, or 0 at its end.
+*/
+unsigned capture_do_capture(
     CaptureContext *ctx,
     void (*consume)(
         CaptureContext *ctx,
         const sample_t *restrict samples,
+        unsigned n,
         void *p
     ),
     void *p
 ) {
+    if (ctx->replay)
+        return replay_read(ctx->replay, ctx, consume, p) ? ctx->period : 0;
+
+    PROF_BEGIN(PROF_CAPTURE_WAIT);
     snd_pcm_sframes_t avail;
     do
         avail = capture_wait(ctx);
     while (avail == 0);
+    PROF_END(PROF_CAPTURE_WAIT);
 
-    const snd_pcm_channel_area_t *areas;
-    snd_pcm_uframes_t offset, frames = ctx->period;
-    int err = snd_pcm_mmap_begin(ctx->pcm, &areas, &offset, &frames);
-    if (err < 0)
+    unsigned delivered = 0;
+    while (avail > 0)
     {
-        warn_snd(err);
-        return;
-    }
+        const snd_pcm_channel_area_t *areas;
+        snd_pcm_uframes_t offset, frames = avail;
+        int err = snd_pcm_mmap_begin(ctx->pcm, &areas, &offset, &frames);
+        if (err < 0)
+        {
+            warn_snd(err);
+            break;
+        }
 
-    // Assume start offset bit-alignment
-    assert(areas->first % 8 == 0);  
-    // Assume fully-contiguous samples
-    assert(areas->step == 8*sizeof(sample_t));
+        // Assume start offset bit-alignment
+        assert(areas->first % 8 == 0);
+        // Assume fully-contiguous samples
+        assert(areas->step == 8*sizeof(sample_t));
 
-    snd_pcm_uframes_t used;
-    if (frames >= ctx->period)
-    {
-        used = ctx->period;
+        // Up to the end of the area; the rest, if any, is from its start.
+        if (frames > 0)
+        {
+            const sample_t *samples = (sample_t*)(
+                (uint8_t*)areas->addr
+                + (areas->first / 8)
+            ) + offset;
 
-        const sample_t *samples = (sample_t*)(
-            (uint8_t*)areas->addr
-            + (areas->first / 8)
-        ) + offset;
+            consume(ctx, samples, frames, p);
+        }
 
-        consume(ctx, samples, p);
-    }
-    else
-    {
-        fprintf(
-            stderr,
-            "Short read %ld < %u\n",
-            frames,
-            ctx->period
+        snd_pcm_sframes_t transferred = snd_pcm_mmap_commit(
+            ctx->pcm, offset, frames
         );
-        used = 0;
+        if (transferred < 0)
+        {
+            warn_snd(transferred);
+            ctx->restart = true;
+            break;
+        }
+        delivered += transferred;
+        if ((snd_pcm_uframes_t)transferred < frames || frames == 0)
+            break;
+        avail -= transferred;
     }
-
-    snd_pcm_sframes_t transferred = snd_pcm_mmap_commit(
-        ctx->pcm, offset, used
-    );
-    warn_snd(transferred);
+    return delivered;
 }
 
 unsigned capture_period(CaptureContext *c)
@@ -814,3 +967,15 @@ unsigned capture_rate(CaptureContext *c)
 {
     return c->rate;
 }
+
+// Only a replay ever runs out.
+bool capture_eof(CaptureContext *c)
+{
+    return c->replay && replay_eof(c->replay);
+}
+
+// Whether samples arrive at the sampling rate, rather than whenever asked for.
+bool capture_realtime(CaptureContext *c)
+{
+    return !c->replay || !replay_fast(c->replay);
+}
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stdint.h>
+
 
 struct CaptureContextTag;
 typedef struct CaptureContextTag CaptureContext;
@@ -8,14 +11,26 @@ typedef struct CaptureContextTag CaptureContext;
 typedef int16_t sample_t;
 
 
-CaptureContext *capture_init(void);
+typedef struct
+{
+    // Replay this WAV or raw S16 mono file instead of capturing from ALSA.
+    const char *replay;
+    // Replay as fast as the samples are taken, rather than in real time.
+    bool fast;
+    // Sampling rate of raw replay files, which don't say.
+    unsigned raw_rate;
+} CaptureOptions;
+
+
+CaptureContext *capture_init(const CaptureOptions *opts);
 void capture_deinit(CaptureContext**);
 
-void capture_do_capture(
+unsigned capture_do_capture(
     CaptureContext *ctx,
     void (*consume)(
         CaptureContext *cc,
         const sample_t *restrict samples,
+        unsigned n,
         void *p
     ),
     void *p
@@ -23,3 +38,5 @@ void capture_do_capture(
 
 unsigned capture_period(CaptureContext *c);
 unsigned capture_rate(CaptureContext *c);
+bool capture_eof(CaptureContext *c);
+bool capture_realtime(CaptureContext *c);
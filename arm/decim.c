@@ -0,0 +1,93 @@
+#include <assert.h>
+#include <math.h>
+#include <stdint.h>
+
+#include "decim.h"
+
+/*
+Low-pass filtering and decimation by two, for the multirate detector. Cascaded,
+this gives the 2x, 4x and 8x streams that the bass is detected from.
+
+The filter is a Blackman-windowed half-band FIR: its cutoff is a quarter of the
+input rate, which is the output's Nyquist frequency. That makes every other tap
+zero apart from the centre one, and since only every other output is worked out
+at all (the polyphase part), each output costs one multiply per pair of
+symmetric non-zero taps, (DECIM_TAPS + 1)/4 of them, plus the centre.
+
+It passes about 0.2 of the input rate and stops from about 0.3. What aliases
+lands above 0.2 of the input rate, i.e. at the top of the output band, which
+the detector never uses from a decimated band; notes up there come from a
+finer one.
+*/
+
+#define CENTRE ((DECIM_TAPS - 1)/2)
+#define N_PAIRS ((DECIM_TAPS + 1)/4)
+
+// pairs[i] is the tap at CENTRE +- (2i + 1).
+static float centre, pairs[N_PAIRS];
+
+
+void decim_init(void)
+{
+    double sum = 0.5, h[N_PAIRS];
+    for (unsigned i = 0; i < N_PAIRS; i++)
+    {
+        int k = 2*i + 1;
+        double sinc = sin(M_PI*k/2) / (M_PI*k),
+               w = CENTRE + k,
+               window = 0.42 - 0.5*cos(2*M_PI*w/(DECIM_TAPS - 1))
+                      + 0.08*cos(4*M_PI*w/(DECIM_TAPS - 1));
+        h[i] = sinc*window;
+        sum += 2*h[i];
+    }
+    // Unity gain at DC
+    centre = 0.5/sum;
+    for (unsigned i = 0; i < N_PAIRS; i++)
+        pairs[i] = h[i]/sum;
+}
+
+
+/*
+Filter and decimate n samples of in (n even) to n/2 samples of out. The
+DECIM_TAPS - 1 samples before in[0] are read too, so in has to carry on from
+whatever the last call's did, the way a VRB's past does.
+
+Output j is centred on in[2j + 1 - CENTRE]; i.e. everything is delayed by
+CENTRE input samples, which nobody cares about.
+*/
+void decimate(const float *restrict in, unsigned n, float *restrict out)
+{
+    assert(n % 2 == 0);
+    for (unsigned j = 0; j < n/2; j++)
+    {
+        const float *x = in + 2*j + 1 - CENTRE;
+        float y = centre*x[0];
+        for (unsigned i = 0; i < N_PAIRS; i++)
+            y += pairs[i]*(x[-(int)(2*i + 1)] + x[2*i + 1]);
+        out[j] = y;
+    }
+}
+
+
+/*
+The same for int16 history, for the fixed-point path. The filter itself is
+still worked out in float; only what's stored is rounded, and saturated to
++-INT16_MAX like ingest() does.
+*/
+void decimate_s16(const int16_t *restrict in, unsigned n, int16_t *restrict out)
+{
+    assert(n % 2 == 0);
+    for (unsigned j = 0; j < n/2; j++)
+    {
+        const int16_t *x = in + 2*j + 1 - CENTRE;
+        float y = centre*x[0];
+        for (unsigned i = 0; i < N_PAIRS; i++)
+            y += pairs[i]*(x[-(int)(2*i + 1)] + x[2*i + 1]);
+        if (y > INT16_MAX)
+            y = INT16_MAX;
+        if (y < -INT16_MAX)
+            y = -INT16_MAX;
+        // Rounds half away from zero, unlike lrintf(), but vectorises.
+        out[j] = y + copysignf(0.5f, y);
+    }
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <stdint.h>
+
+// Taps in the half-band decimation filter. Of the form 4k + 3, so that the
+// taps at both ends are non-zero.
+#define DECIM_TAPS 47
+
+void decim_init(void);
+void decimate(const float *restrict in, unsigned n, float *restrict out);
+void decimate_s16(
+    const int16_t *restrict in, unsigned n, int16_t *restrict out
+);
@@ -0,0 +1,778 @@
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+
+#include "bank.h"
+#include "decim.h"
+#include "detect.h"
+#include "freq.h"
+#include "iac.h"
+#include "onset.h"
+#include "prof.h"
+#include "spectrum.h"
+
+/*
+The tuner's note detection, one period at a time. This is what main() runs on
+the capture feed, and what the benchmark runs on synthetic notes, so that the
+one being measured is the one being shipped.
+
+While it's quiet, nothing is computed. Once a period is loud enough, the next
+hist_len samples are skipped, since the strike's transients mess with the
+reading. After that, every period gives a reading from the sliding-window
+autocorrelation, until the note dies away. With the onset gate
+(detector_onset(), onset.c), the attack is only sat out until the envelope
+settles, which for most strikes is far sooner; hist_len is then only the most
+it's given.
+
+The autocorrelation is multirate. The capture stream is low-passed and
+decimated by 2, 4 and 8 into bands of their own, and every band autocorrelates
+the same small number of lags, so each covers a lower octave range than the
+one above it. A0's period, which needs ~1750 lags at 48 kHz, only needs ~220
+at 6 kHz. Each period, the coarsest band gives a rough frequency, and the
+reading is then taken from the finest band whose lags reach far enough back for
+it. Only those two bands are kept up to date; the chosen one is primed from its
+history when it changes. The decimation is done all the time, so that every
+band always has history, but it's cheap next to the autocorrelation.
+
+With progressive estimates (detector_progressive()), the search narrows as the
+note goes on. From the strike, before the attack is over, the coarse band
+alone gives rough readings from however short a window it has. Then once two
+readings in a row agree, the band they came from is locked onto: from then on,
+only its lags within LOCK_SEMITONES of the reading are summed, and the coarse
+band isn't run at all, until the peak leaves that window. Most of a held note
+then costs a few dozen lags a period rather than two bands' worth.
+
+When the key being tuned is known (detector_target()), there's no coarse
+estimate: the band is the one that would be chosen for the key, and only the
+lags within TARGET_SEMITONES of its period are summed, plus lag 0 for the
+threshold. That's a few dozen lags instead of hundreds, and for the top of the
+keyboard only a handful.
+
+The history can be floats or, for the fixed-point path, int16s, in which case
+the decimated bands are int16 too and every autocorrelation is done in integers
+(see fixed.c).
+
+With a key targeted, the autocorrelation can be swapped out for the spectral
+engine (detector_spectrum(), spectrum.c), which reads every partial of the key
+off a long FFT of the full-rate history. That needs a second or so of history,
+and is only run every SPECTRUM_INTERVAL samples, in between which the last
+reading stands. The decimated bands aren't needed then, and aren't kept.
+Alternatively, the same partials can be read off a sliding DFT of only the bins
+around them (detector_bank(), bank.c), which is cheap enough to run every
+period.
+
+The autocorrelation can also be read as its NSDF (detector_nsdf(), see
+iac_read_nsdf()), which is normalised for the energy at each lag, so it doesn't
+need the history full of the note to be unbiased. The window then starts the
+period after the strike, and a reading is given as soon as it holds two cycles
+of a clear peak, instead of after hist_len. Until then, or hist_len, whichever
+is first, the detector stays quiet as before.
+*/
+
+#define POWER_THRESHOLD 64
+// How many periods of products the autocorrelation is averaged over.
+#define AC_WINDOW_PERIODS 8
+// Decimation stages, each by 2. Bands 0 to N_BANDS - 1 run at rate >> band.
+#define DECIM_STAGES 3
+#define N_BANDS (DECIM_STAGES + 1)
+/*
+The most of a band's lags that a note's period may take up for that band to be
+used for it. The rest leaves room for the peak to finish, and for the coarse
+estimate to be out.
+*/
+#define BAND_FIT 0.7f
+// How far out of tune a targeted key may be and still be found.
+#define TARGET_SEMITONES 3
+// Targeted lag windows are whole blocks of the SIMD kernel, which is cheaper
+// than leftover lags done one at a time.
+#define TARGET_LAG_ROUND 8
+// How far either side of a locked-onto reading the lags reach, and how close
+// two readings in a row have to be to lock onto.
+#define LOCK_SEMITONES 3
+#define LOCK_CENTS 20
+// Samples between spectral engine updates; python/params.py's frame length.
+#define SPECTRUM_INTERVAL 1024
+/*
+The least the onset gate lets an attack take, which is about how long the
+hammer is on the string: longest at A0, shortest at C8, and the bass's when
+the key isn't known.
+*/
+#define ATTACK_MIN_BASS 4e-3f
+#define ATTACK_MIN_TREBLE 1e-3f
+/*
+The least of a period's power that the coarse band has to hold for its
+estimate to be believed. The top few keys are above everything it passes, and
+in what's left of them, mostly noise, it finds spurious periods at the far end
+of its lags.
+*/
+#define COARSE_POWER_MIN 0.1f
+
+
+typedef enum
+{
+    DETECT_IDLE,
+    DETECT_FILLING,
+    DETECT_TRACKING
+} DetectState;
+
+
+typedef struct
+{
+    // Band 0 is the caller's history; the others are owned.
+    VRB *b;
+    unsigned rate, period, window;
+    // Lowest frequency this band is used for.
+    float fmin;
+    IAC *iac;
+} Band;
+
+
+struct DetectorTag
+{
+    unsigned nac, period, rate, hist_len;
+    VRBFormat format;
+    Band bands[N_BANDS];
+
+    DetectState state;
+    // Mean power of the period just read.
+    float power;
+    // Samples read since the note started, while filling, and whether its
+    // attack is over.
+    unsigned filled;
+    bool settled;
+    // Full-rate samples summed into the coarse band since tracking started, up
+    // to the window.
+    unsigned tracked;
+    // The band that readings came from last period, or -1.
+    int fine;
+    // The band of the targeted key, or -1 when not targeting.
+    int target;
+
+    // Whether the search narrows as the note goes on; the band that's locked
+    // onto, or -1; whether the coarse band has missed periods since; and the
+    // last reading.
+    bool progressive;
+    int locked;
+    bool stale;
+    float last_f;
+
+    // The spectral engine, if it's in use, samples since it last ran, and
+    // what it read then.
+    Spectrum *spectrum;
+    unsigned since_spectrum;
+    float spectrum_f;
+    // The sliding DFT bank, if it's in use instead.
+    Bank *bank;
+
+    // Whether lags are read as the NSDF rather than the autocorrelation.
+    bool nsdf;
+
+    // Whether attacks are gated by their envelope rather than hist_len, the
+    // gate, and the least time it gives the targeted key's attack.
+    bool gated;
+    Onset onset;
+    float attack_min;
+
+    float *ac;
+};
+
+
+/*
+aclen is the longest lag to reach at the full rate, i.e. the capture rate over
+the lowest frequency to detect. Every band gets aclen >> DECIM_STAGES lags.
+The history given to detector_update() has to be in the given format.
+*/
+Detector *detector_create(
+    unsigned aclen, unsigned period, unsigned rate, VRBFormat format
+)
+{
+    Detector *d = malloc(sizeof(Detector));
+    assert(d);
+
+    assert(period % (1 << DECIM_STAGES) == 0);
+    d->nac = aclen >> DECIM_STAGES;
+    d->period = period;
+    d->rate = rate;
+    d->format = format;
+    d->hist_len = aclen + period;
+    d->state = DETECT_IDLE;
+    d->filled = 0;
+    d->tracked = 0;
+    d->fine = -1;
+    d->target = -1;
+    d->progressive = false;
+    d->locked = -1;
+    d->stale = false;
+    d->last_f = -1;
+    d->spectrum = NULL;
+    d->bank = NULL;
+    d->nsdf = false;
+    d->gated = false;
+    onset_init(&d->onset, rate);
+    d->attack_min = ATTACK_MIN_BASS;
+
+    decim_init();
+    for (unsigned k = 0; k < N_BANDS; k++)
+    {
+        Band *band = d->bands + k;
+        band->rate = rate >> k;
+        band->period = period >> k;
+        band->window = AC_WINDOW_PERIODS*band->period;
+        band->fmin = k == N_BANDS - 1 ? 0 : band->rate/(BAND_FIT*d->nac);
+        band->iac = iac_create(d->nac, band->window, format);
+        band->b = k ? vrb_create(
+            (d->nac + band->window + band->period + DECIM_TAPS)
+            * vrb_format_size(format)
+        ) : NULL;
+
+        // Planning can take a while, so get it done before audio arrives.
+        if (format == VRB_FLOAT)
+            autocorrelate_plan(d->nac + band->period, d->nac);
+    }
+
+    d->ac = malloc(d->nac*sizeof(float));
+    assert(d->ac);
+
+    return d;
+}
+
+
+void detector_destroy(Detector **d)
+{
+    for (unsigned k = 0; k < N_BANDS; k++)
+    {
+        Band *band = (*d)->bands + k;
+        iac_destroy(band->iac);
+        if (k)
+            vrb_destroy(band->b);
+    }
+    if ((*d)->spectrum)
+        spectrum_destroy(&(*d)->spectrum);
+    if ((*d)->bank)
+        bank_destroy(&(*d)->bank);
+    free((*d)->ac);
+    free(*d);
+    *d = NULL;
+}
+
+
+/*
+How many samples behind the read cursor have to be kept for the autocorrelator
+to reach back over its whole window, and for the decimator's taps.
+*/
+unsigned detector_history(const Detector *d)
+{
+    unsigned history = d->nac + d->bands[0].window + d->period + DECIM_TAPS;
+    if (d->spectrum && spectrum_length(d->spectrum) > history)
+        history = spectrum_length(d->spectrum);
+    if (d->bank && bank_length(d->bank) + d->period > history)
+        history = bank_length(d->bank) + d->period;
+    return history;
+}
+
+
+// Whether partials are read instead of autocorrelating, one way or another.
+static bool spectral(const Detector *d)
+{
+    return d->spectrum || d->bank;
+}
+
+
+/*
+Use the spectral engine instead of autocorrelation, keeping FFT wisdom in the
+given file (or none, if NULL). It only works on a targeted key, so
+detector_target() has to be given one. This changes detector_history().
+*/
+void detector_spectrum(Detector *d, const char *wisdom)
+{
+    assert(!spectral(d) && !d->nsdf);
+    d->spectrum = spectrum_create(d->rate, wisdom);
+}
+
+
+/*
+Like detector_spectrum(), but with the sliding DFT bank, which gives the same
+readings every period for a fraction of the work.
+*/
+void detector_bank(Detector *d)
+{
+    assert(!spectral(d) && !d->nsdf);
+    d->bank = bank_create(d->rate);
+}
+
+
+/*
+Read the lag sums as the NSDF from now on, which gives a reading sooner after a
+strike. Not for use with the spectral engine, which has no lag sums.
+*/
+void detector_nsdf(Detector *d)
+{
+    assert(!spectral(d));
+    d->nsdf = true;
+}
+
+
+/*
+Give rough readings during the attack, and narrow the search once the note is
+found. Without a targeted key, that's most of the work gone from every period
+of a held note.
+*/
+void detector_progressive(Detector *d)
+{
+    d->progressive = true;
+}
+
+
+/*
+End each attack once its envelope settles, instead of after hist_len, so that
+analysis can start sooner.
+*/
+void detector_onset(Detector *d)
+{
+    d->gated = true;
+}
+
+
+// The partials from the spectral engine's last reading, or NULL without it.
+const Partial *detector_partials(const Detector *d)
+{
+    if (d->bank)
+        return bank_partials(d->bank);
+    return d->spectrum ? spectrum_partials(d->spectrum) : NULL;
+}
+
+
+// Run the period just read in hist down through the decimated bands.
+static void decimate_bands(Detector *d, VRB *hist)
+{
+    size_t size = vrb_format_size(d->format);
+    d->bands[0].b = hist;
+    for (unsigned k = 1; k < N_BANDS; k++)
+    {
+        const Band *above = d->bands + k - 1;
+        Band *band = d->bands + k;
+        const void *in = vrb_past(
+            above->b, (above->period + DECIM_TAPS - 1)*size
+        );
+        if (d->format == VRB_S16)
+        {
+            decimate_s16(
+                (const int16_t*)in + DECIM_TAPS - 1, above->period,
+                band->b->present
+            );
+        }
+        else
+        {
+            decimate(
+                (const float*)in + DECIM_TAPS - 1, above->period,
+                band->b->present
+            );
+        }
+        vrb_advance(band->b, band->period*size);
+    }
+}
+
+
+// The band's current window, as whichever function the lags are read as.
+static void read_lags(Detector *d, Band *band)
+{
+    if (d->nsdf)
+        iac_read_nsdf(band->iac, band->b, d->ac);
+    else
+        iac_read(band->iac, d->ac);
+}
+
+
+/*
+With the NSDF, only believe a peak once the window holds two of its cycles, or
+is as full as it gets; with fewer, any period that fits reads as clear.
+*/
+static float checked(const Detector *d, const Band *band, float f)
+{
+    const IAC *a = band->iac;
+    if (d->nsdf && f > 0 && a->count < a->window && 2*band->rate > f*a->count)
+        return -1;
+    return f;
+}
+
+
+/*
+Bring a band's autocorrelation up to date with the period just read: either
+add that period, or if the band wasn't in use last period, start it again from
+all of the note so far that its window holds. Then take a reading from it.
+*/
+static float band_freq(Detector *d, Band *band, bool prime)
+{
+    PROF_BEGIN(PROF_AUTOCORRELATE);
+    if (prime)
+    {
+        unsigned k = band - d->bands;
+        iac_prime(band->iac, band->b, d->tracked >> k, band->period);
+    }
+    else
+        iac_update(band->iac, band->b, band->period);
+    read_lags(d, band);
+    PROF_END(PROF_AUTOCORRELATE);
+
+    PROF_BEGIN(PROF_FREQ);
+    float f = checked(d, band, freq(d->ac, d->nac, band->rate));
+    PROF_END(PROF_FREQ);
+    return f;
+}
+
+
+// Whether the coarse band holds enough of the period just read to see its note.
+static bool coarse_sees(const Detector *d)
+{
+    const Band *band = d->bands + N_BANDS - 1;
+    double energy = 0;
+    if (d->format == VRB_S16)
+    {
+        const int16_t *x = vrb_past(band->b, band->period*sizeof(int16_t));
+        for (unsigned i = 0; i < band->period; i++)
+            energy += x[i]*x[i];
+    }
+    else
+    {
+        const float *x = vrb_past(band->b, band->period*sizeof(float));
+        for (unsigned i = 0; i < band->period; i++)
+            energy += x[i]*x[i];
+    }
+    return energy >= COARSE_POWER_MIN*d->power*band->period;
+}
+
+
+// The finest band whose lags reach back far enough for f.
+static int fine_band(const Detector *d, float f)
+{
+    if (!(f > 0))  // Including NaN
+        return 0;
+    for (unsigned k = 0; k < N_BANDS; k++)
+        if (f >= d->bands[k].fmin)
+            return k;
+    return N_BANDS - 1;
+}
+
+
+// Read a band that only has a window of lags: the targeted or locked one.
+static float window_freq(Detector *d, Band *band)
+{
+    PROF_BEGIN(PROF_AUTOCORRELATE);
+    iac_update(band->iac, band->b, band->period);
+    read_lags(d, band);
+    PROF_END(PROF_AUTOCORRELATE);
+
+    PROF_BEGIN(PROF_FREQ);
+    float f = checked(
+        d, band, freq_window(d->ac, band->iac->lo, band->iac->hi, band->rate)
+    );
+    PROF_END(PROF_FREQ);
+    return f;
+}
+
+
+/*
+Read the targeted key's partials off the spectrum, if it's time to, or repeat
+the last reading if not.
+*/
+static float spectrum_target_freq(Detector *d, VRB *hist)
+{
+    if (d->since_spectrum >= SPECTRUM_INTERVAL)
+    {
+        PROF_BEGIN(PROF_AUTOCORRELATE);
+        spectrum_update(d->spectrum, hist, d->format);
+        PROF_END(PROF_AUTOCORRELATE);
+
+        PROF_BEGIN(PROF_FREQ);
+        d->spectrum_f = spectrum_freq(d->spectrum);
+        PROF_END(PROF_FREQ);
+        d->since_spectrum = 0;
+    }
+    d->since_spectrum += d->period;
+    return d->spectrum_f;
+}
+
+
+// Slide the bank along by the period just read, and read the key's partials.
+static float bank_target_freq(Detector *d, VRB *hist)
+{
+    PROF_BEGIN(PROF_AUTOCORRELATE);
+    bank_update(d->bank, hist, d->format, d->period);
+    PROF_END(PROF_AUTOCORRELATE);
+
+    PROF_BEGIN(PROF_FREQ);
+    float f = bank_freq(d->bank);
+    PROF_END(PROF_FREQ);
+    return f;
+}
+
+
+// Only sum the lags of a band within the given semitones of f's period.
+static void narrow(Detector *d, Band *band, float f, float semitones)
+{
+    float period = band->rate / f, spread = powf(SEMI, semitones);
+    unsigned lo = period/spread - 1,
+             hi = period*spread + 2;
+    if (lo < 1)
+        lo = 1;
+    hi = lo + (hi - lo + TARGET_LAG_ROUND - 1)/TARGET_LAG_ROUND*TARGET_LAG_ROUND;
+    if (hi > d->nac)
+        hi = d->nac;
+    iac_set_lags(band->iac, lo, hi);
+}
+
+
+/*
+Narrow band k down to f, and bring it back up to date from the note so far.
+The coarse band stops being run, so it will need priming again.
+*/
+static void lock(Detector *d, unsigned k, float f)
+{
+    Band *band = d->bands + k;
+    PROF_BEGIN(PROF_AUTOCORRELATE);
+    narrow(d, band, f, LOCK_SEMITONES);
+    iac_prime(band->iac, band->b, d->tracked >> k, band->period);
+    PROF_END(PROF_AUTOCORRELATE);
+    d->locked = k;
+    d->stale = true;
+}
+
+
+// Go back to searching every lag; the next reading primes what it uses.
+static void unlock(Detector *d)
+{
+    iac_set_lags(d->bands[d->locked].iac, 0, d->nac);
+    d->locked = -1;
+    d->fine = -1;
+}
+
+
+// Forget the note so far; the next period starts the window again.
+static void restart(Detector *d)
+{
+    if (d->locked >= 0)
+        unlock(d);
+    d->stale = false;
+    d->last_f = -1;
+    if (d->target >= 0)
+        iac_reset(d->bands[d->target].iac);
+    else
+        iac_reset(d->bands[N_BANDS - 1].iac);
+    d->tracked = 0;
+    d->fine = -1;
+    // The spectrum has no window to restart, but there's a new note to read.
+    d->since_spectrum = SPECTRUM_INTERVAL;
+    if (d->bank)
+        bank_reset(d->bank);
+}
+
+
+/*
+Only look for the given key (0 for A0 up to N_NOTES - 1), or for anything
+again if key is negative. Whatever note was being tracked is forgotten.
+*/
+void detector_target(Detector *d, int key)
+{
+    for (unsigned k = 0; k < N_BANDS; k++)
+        iac_set_lags(d->bands[k].iac, 0, d->nac);
+    d->target = -1;
+    d->locked = -1;
+    d->state = DETECT_IDLE;
+    d->attack_min = ATTACK_MIN_BASS;
+
+    if (key < 0)
+    {
+        assert(!spectral(d));
+        return;
+    }
+    assert(key < N_NOTES);
+    if (d->spectrum)
+        spectrum_set_note(d->spectrum, key);
+    if (d->bank)
+        bank_set_note(d->bank, key);
+
+    d->attack_min = ATTACK_MIN_BASS * powf(
+        ATTACK_MIN_TREBLE/ATTACK_MIN_BASS, (float)key/(N_NOTES - 1)
+    );
+
+    float f = freq_of_key(key);
+    d->target = fine_band(d, f);
+    narrow(d, d->bands + d->target, f, TARGET_SEMITONES);
+}
+
+
+// Whether the strike's attack is over, as of the period just read into hist.
+static bool attack_over(Detector *d, VRB *hist)
+{
+    if (d->gated)
+    {
+        const void *x = vrb_past(hist, d->period*vrb_format_size(d->format));
+        if (onset_update(&d->onset, x, d->format, d->period))
+            return true;
+    }
+    return d->filled >= d->hist_len;
+}
+
+
+// Count the period just read into the note's window.
+static void track(Detector *d)
+{
+    d->tracked += d->period;
+    if (d->tracked > d->bands[0].window)
+        d->tracked = d->bands[0].window;
+}
+
+
+// A rough reading from the short window since the strike, during the attack.
+static float early_freq(Detector *d)
+{
+    track(d);
+    if (d->target >= 0)
+        return window_freq(d, d->bands + d->target);
+    float f = band_freq(d, d->bands + N_BANDS - 1, false);
+    return coarse_sees(d) ? f : -1;
+}
+
+
+// Take a reading from the period just read into hist, while there's a note.
+static float reading(Detector *d, VRB *hist)
+{
+    track(d);
+
+    if (d->spectrum)
+    {
+        assert(d->target >= 0);
+        return spectrum_target_freq(d, hist);
+    }
+    if (d->bank)
+    {
+        assert(d->target >= 0);
+        return bank_target_freq(d, hist);
+    }
+    if (d->target >= 0)
+        return window_freq(d, d->bands + d->target);
+
+    if (d->locked >= 0)
+    {
+        float f = window_freq(d, d->bands + d->locked);
+        if (f > 0 && fine_band(d, f) == d->locked)
+            return f;
+        unlock(d);
+    }
+
+    float f = band_freq(d, d->bands + N_BANDS - 1, d->stale);
+    d->stale = false;
+    int k = fine_band(d, f);
+    // Too high for the coarse band, which can only have read noise
+    if (k == N_BANDS - 1 && f > 0 && !coarse_sees(d))
+        k = 0;
+    if (k != N_BANDS - 1)
+        f = band_freq(d, d->bands + k, k != d->fine);
+    /*
+    A rough estimate, say from the hammer's noise, can pick a band too coarse
+    for what that band then reads; go on down to the one that fits it.
+    */
+    for (int j; f > 0 && (j = fine_band(d, f)) < k; k = j)
+        f = band_freq(d, d->bands + j, true);
+    d->fine = k;
+
+    // Only ever lock onto the band that fits the reading.
+    if (
+        d->progressive && f > 0 && d->last_f > 0 && fine_band(d, f) == k
+        && fabsf(1200*log2f(f/d->last_f)) < LOCK_CENTS
+    )
+        lock(d, k, f);
+    d->last_f = f;
+    return f;
+}
+
+
+/*
+Take the period just read into hist, whose mean power is given. lost says
+whether audio was dropped before it. Returns true if there is a note, in which
+case *f is its frequency, or negative if none could be found in it.
+*/
+bool detector_update(
+    Detector *d, VRB *hist, float power, bool lost, float *f
+)
+{
+    d->power = power;
+    if (!spectral(d))
+        decimate_bands(d, hist);
+
+    switch (d->state)
+    {
+        case DETECT_IDLE:
+            if (power > POWER_THRESHOLD)
+            {
+                d->state = DETECT_FILLING;
+                d->filled = 0;
+                d->settled = false;
+                if (d->gated)
+                {
+                    onset_start(&d->onset, d->attack_min, POWER_THRESHOLD);
+                    d->settled = attack_over(d, hist);
+                }
+                /*
+                The NSDF isn't thrown by the attack the way the plain
+                autocorrelation is, so its window starts with the next period
+                whatever the gate says; the gate only holds its readings back.
+                */
+                else if (d->nsdf)
+                    d->settled = true;
+                // As do the windows of progressive early readings.
+                if (d->nsdf || d->progressive)
+                    restart(d);
+            }
+            return false;
+
+        case DETECT_FILLING:
+            d->filled += d->period;
+            if (power < POWER_THRESHOLD)
+            {
+                d->state = DETECT_IDLE;
+                return false;
+            }
+            if (!d->settled)
+                d->settled = attack_over(d, hist);
+            if (d->nsdf)
+            {
+                if (lost)
+                    restart(d);
+                *f = reading(d, hist);
+                if (!(d->settled && *f > 0) && d->filled < d->hist_len)
+                    return false;
+                d->state = DETECT_TRACKING;
+                return true;
+            }
+            if (!d->settled)
+            {
+                if (!d->progressive || spectral(d))
+                    return false;
+                *f = early_freq(d);
+                return *f > 0;
+            }
+            /*
+            Each period only costs the products of its own samples against the
+            lags, plus those of the period leaving the window, no matter how
+            long the window is.
+            */
+            restart(d);
+            d->state = DETECT_TRACKING;
+            break;
+
+        case DETECT_TRACKING:
+            if (power < POWER_THRESHOLD)
+            {
+                d->state = DETECT_IDLE;
+                return false;
+            }
+            // The window's products span a gap; start it again.
+            if (lost)
+                restart(d);
+            break;
+    }
+
+    *f = reading(d, hist);
+    return true;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "spectrum.h"
+#include "vrb.h"
+
+
+struct DetectorTag;
+typedef struct DetectorTag Detector;
+
+
+Detector *detector_create(
+    unsigned aclen, unsigned period, unsigned rate, VRBFormat format
+);
+void detector_destroy(Detector **d);
+
+unsigned detector_history(const Detector *d);
+void detector_target(Detector *d, int key);
+void detector_spectrum(Detector *d, const char *wisdom);
+void detector_bank(Detector *d);
+void detector_nsdf(Detector *d);
+void detector_onset(Detector *d);
+void detector_progressive(Detector *d);
+const Partial *detector_partials(const Detector *d);
+bool detector_update(
+    Detector *d, VRB *hist, float power, bool lost, float *f
+);
@@ -0,0 +1,389 @@
+#include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <sys/eventfd.h>
+
+#include "feed.h"
+#include "ingest.h"
+#include "prof.h"
+#include "rt.h"
+#include "util.h"
+
+/*
+Capture runs on its own realtime thread so that it never waits on analysis.
+That thread is the only writer of a VRB of samples (floats, or int16s for the
+fixed-point path), and publishes how far it has got through vrb_written(). The
+analysis thread is the only reader: it follows with a VRBCursor, whose view is
+of the same memory but with the read position as its present, so that
+everything that works on a VRB (vrb_past(), IAC) works on the view unchanged
+and without copying.
+
+Nothing is locked. The capture thread never looks at the reader at all; the
+reader notices that it has been lapped by comparing its cursor against the
+written count, and skips ahead. Since it can also be lapped while it's still
+analysing what it read, it checks again once it's done, as a seqlock reader
+would, against how far capture has claimed it's about to write (vrb_claim()),
+and counts anything written over as lost on the next read. The exception is a
+capture that isn't realtime (a fast replay), which would otherwise lap the
+reader constantly; there, the capture thread waits for the reader to make room
+instead.
+
+The capture thread also works out the energy of every period-sized block of the
+stream as it converts it, so the reader gets each period's power for free
+instead of reading the period back again.
+*/
+
+#define CAPTURE_PRIORITY 80
+
+
+struct FeedTag
+{
+    CaptureContext *capture;
+    pthread_t thread;
+
+    // Written by the capture thread only.
+    VRB *b;
+    // Advanced by the analysis thread only. Its memory is b's.
+    VRBCursor cursor;
+    // How many samples behind the cursor the reader needs kept intact.
+    unsigned history;
+    // Bytes per sample in b.
+    size_t size;
+
+    Ingest ingest;
+    unsigned period;
+    // Energy of each period-long block of the stream, block k at
+    // energies[k % n_blocks]; one more than the VRB holds, so that the reader
+    // can always see every block it can see samples for.
+    float *energies;
+    unsigned n_blocks;
+    // Energy of the block currently being filled, and how far into it we are.
+    float block_energy;
+    unsigned block_fill;
+
+    // Bumped after every capture, for the reader to sleep on.
+    _Atomic uint32_t captures;
+    // Also signalled after every capture, for a reader that waits on more
+    // than just the feed.
+    int event;
+    // Bumped after every read when lossless, for the capture thread to sleep
+    // on.
+    _Atomic uint32_t reads;
+    bool lossless;
+    _Atomic bool stop, eof;
+};
+
+
+static void consume(
+    CaptureContext *cc, const sample_t *restrict samples, unsigned N, void *p
+)
+{
+    PROF_BEGIN(PROF_INGEST);
+    Feed *feed = p;
+    VRB *b = feed->b;
+    char *restrict present = b->present;
+    size_t block = vrb_written(b)/feed->size/feed->period;
+    vrb_claim(b, N*feed->size);
+
+    // Split at block boundaries, so that every block gets its own energy.
+    for (unsigned i = 0; i < N;)
+    {
+        unsigned n = feed->period - feed->block_fill;
+        if (n > N - i)
+            n = N - i;
+
+        feed->block_energy += ingest(
+            &feed->ingest, samples + i, present + i*feed->size, n
+        );
+        feed->block_fill += n;
+        i += n;
+
+        if (feed->block_fill == feed->period)
+        {
+            feed->energies[block++ % feed->n_blocks] = feed->block_energy;
+            feed->block_energy = 0;
+            feed->block_fill = 0;
+        }
+    }
+
+    // Publishes the energies along with the samples.
+    vrb_advance(b, N*feed->size);
+    PROF_END(PROF_INGEST);
+}
+
+
+/*
+Wait until another period can be written without overwriting anything the
+reader still needs. Returns false if told to stop meanwhile. Only a replay is
+ever lossless, and that's always captured a period at a time.
+*/
+static bool make_room(Feed *feed)
+{
+    size_t need = (feed->history + capture_period(feed->capture))
+                  * feed->size;
+    while (!atomic_load_explicit(&feed->stop, memory_order_relaxed))
+    {
+        uint32_t reads = atomic_load_explicit(
+            &feed->reads, memory_order_acquire
+        );
+        size_t cursor = atomic_load_explicit(
+            &feed->cursor.view.written, memory_order_acquire
+        );
+        if (vrb_written(feed->b) - cursor + need <= feed->b->length)
+            return true;
+        futex_wait(&feed->reads, reads);
+    }
+    return false;
+}
+
+
+static void *capture_thread(void *p)
+{
+    Feed *feed = p;
+
+    // SIGINT is for the main thread to deal with.
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+    rt_enter(RT_CAPTURE);
+    while (!atomic_load_explicit(&feed->stop, memory_order_relaxed))
+    {
+        if (feed->lossless && !make_room(feed))
+            break;
+        capture_do_capture(feed->capture, consume, feed);
+        bool eof = capture_eof(feed->capture);
+        if (eof)
+            atomic_store_explicit(&feed->eof, true, memory_order_release);
+        atomic_fetch_add_explicit(&feed->captures, 1, memory_order_release);
+        futex_wake(&feed->captures, INT_MAX);
+        uint64_t one = 1;
+        (void)!write(feed->event, &one, sizeof(one));
+        if (eof)
+            break;
+    }
+    rt_leave(RT_CAPTURE);
+    return NULL;
+}
+
+
+static void start_thread(Feed *feed)
+{
+    pthread_attr_t attr;
+    assert(pthread_attr_init(&attr) == 0);
+    assert(pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED) == 0);
+    assert(pthread_attr_setschedpolicy(&attr, SCHED_FIFO) == 0);
+    struct sched_param param = {.sched_priority = CAPTURE_PRIORITY};
+    assert(pthread_attr_setschedparam(&attr, &param) == 0);
+
+    int err = pthread_create(&feed->thread, &attr, capture_thread, feed);
+    if (err == EPERM)
+    {
+        fputs(
+            "Not permitted to use SCHED_FIFO; "
+            "capturing at normal priority\n",
+            stderr
+        );
+        err = pthread_create(&feed->thread, NULL, capture_thread, feed);
+    }
+    assert(err == 0);
+
+    assert(pthread_attr_destroy(&attr) == 0);
+}
+
+
+/*
+Start capturing on a new thread. The reader will look back at most history
+samples behind its cursor, and can fall up to slack samples behind capture
+before it starts losing audio. Samples are filtered on the way in as given,
+and kept in the given format.
+*/
+Feed *feed_start(
+    CaptureContext *capture, unsigned history, unsigned slack,
+    IngestFilter filter, VRBFormat format
+)
+{
+    Feed *feed = malloc(sizeof(Feed));
+    assert(feed);
+
+    feed->capture = capture;
+    feed->history = history;
+    feed->size = vrb_format_size(format);
+    feed->b = vrb_create((history + slack)*feed->size);
+
+    ingest_init(&feed->ingest, filter, format, capture_rate(capture));
+    feed->period = capture_period(capture);
+    feed->n_blocks = feed->b->length/feed->size/feed->period + 2;
+    feed->energies = calloc(feed->n_blocks, sizeof(float));
+    assert(feed->energies);
+    feed->block_energy = 0;
+    feed->block_fill = 0;
+
+    vrb_cursor_init(&feed->cursor, feed->b, feed->size, history);
+
+    atomic_init(&feed->captures, 0);
+    feed->event = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    assert(feed->event >= 0);
+    atomic_init(&feed->reads, 0);
+    feed->lossless = !capture_realtime(capture);
+    atomic_init(&feed->stop, false);
+    atomic_init(&feed->eof, false);
+    start_thread(feed);
+
+    return feed;
+}
+
+
+void feed_stop(Feed **feed)
+{
+    Feed *f = *feed;
+    atomic_store_explicit(&f->stop, true, memory_order_relaxed);
+    // In case it's waiting for room.
+    atomic_fetch_add_explicit(&f->reads, 1, memory_order_release);
+    futex_wake(&f->reads, INT_MAX);
+    assert(pthread_join(f->thread, NULL) == 0);
+
+    close(f->event);
+    vrb_destroy(f->b);
+    free(f->energies);
+    free(f);
+    *feed = NULL;
+
+    puts("Feed stopped");
+}
+
+
+/*
+The reader's view of the capture history. Its present is the read cursor, so
+vrb_past() on it gives the samples just read and the ones before them.
+*/
+VRB *feed_view(Feed *feed)
+{
+    return &feed->cursor.view;
+}
+
+
+/*
+An eventfd that becomes readable whenever something's been captured (or the
+capture has ended), for waiting on the feed in an event loop alongside other
+things. Whoever waits on it reads it to reset it.
+*/
+int feed_fd(Feed *feed)
+{
+    return feed->event;
+}
+
+
+// Whether capture has ended, so that what's pending is all there'll be.
+bool feed_eof(Feed *feed)
+{
+    return atomic_load_explicit(&feed->eof, memory_order_acquire);
+}
+
+
+/*
+Whether the history behind the cursor is still as it was when last read. If
+not, whatever was just worked out from it can't be trusted, and the next
+feed_read() will say that samples were lost.
+*/
+bool feed_intact(Feed *feed)
+{
+    return !vrb_cursor_overwritten(&feed->cursor);
+}
+
+
+/*
+How many samples have been captured that the reader hasn't read yet. If that's
+more than it's about to read, it's behind, and can skip whatever it only does
+for show until it's caught up.
+*/
+unsigned feed_pending(Feed *feed)
+{
+    return vrb_cursor_pending(&feed->cursor);
+}
+
+
+/*
+The mean power of the n samples before the cursor. When they line up with
+whole blocks, that comes from the energies the capture thread already worked
+out; otherwise (only after a seek) it's summed again here.
+*/
+static float power(Feed *feed, unsigned n)
+{
+    size_t end = atomic_load_explicit(
+        &feed->cursor.view.written, memory_order_relaxed
+    )/feed->size;
+    size_t start = end - n;
+
+    float e = 0;
+    if (start % feed->period == 0 && end % feed->period == 0)
+    {
+        for (size_t k = start/feed->period; k < end/feed->period; k++)
+            e += feed->energies[k % feed->n_blocks];
+    }
+    else if (feed->size == sizeof(int16_t))
+    {
+        const int16_t *x = vrb_cursor_s16(&feed->cursor, n);
+        for (unsigned i = 0; i < n; i++)
+            e += (float)x[i]*x[i];
+    }
+    else
+    {
+        const float *x = vrb_cursor_floats(&feed->cursor, n);
+        for (unsigned i = 0; i < n; i++)
+            e += x[i]*x[i];
+    }
+    return e/n;
+}
+
+
+/*
+Wait for n more samples to be captured, then advance the view over them, and
+set *pow to their mean power. *lost is set to the number of samples that were
+lost because the reader fell so far behind that the capture thread overwrote
+them (or the history before them), either now or while the last ones read were
+still being analysed. In that case anything computed over the old history
+should be thrown away; if it's now, the view also jumps ahead to the newest
+samples. Returns false, having read nothing, if the capture ended first.
+*/
+bool feed_read(Feed *feed, unsigned n, float *pow, unsigned *lost)
+{
+    PROF_BEGIN(PROF_READ_WAIT);
+    while (true)
+    {
+        uint32_t captures = atomic_load_explicit(
+            &feed->captures, memory_order_acquire
+        );
+        // Once this is set, what's pending is final.
+        bool eof = atomic_load_explicit(&feed->eof, memory_order_acquire);
+        if (vrb_cursor_pending(&feed->cursor) >= n)
+            break;
+        if (eof)
+            return false;
+        futex_wait(&feed->captures, captures);
+    }
+    PROF_END(PROF_READ_WAIT);
+
+    size_t overwritten = vrb_cursor_overwritten(&feed->cursor);
+    *lost = vrb_cursor_advance(&feed->cursor, n);
+    if (!*lost)
+        *lost = overwritten;
+
+    *pow = power(feed, n);
+
+    if (feed->lossless)
+    {
+        atomic_fetch_add_explicit(&feed->reads, 1, memory_order_release);
+        futex_wake(&feed->reads, 1);
+    }
+    return true;
+}
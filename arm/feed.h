@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "capture.h"
+#include "ingest.h"
+#include "vrb.h"
+
+
+struct FeedTag;
+typedef struct FeedTag Feed;
+
+
+Feed *feed_start(
+    CaptureContext *capture, unsigned history, unsigned slack,
+    IngestFilter filter, VRBFormat format
+);
+void feed_stop(Feed **feed);
+
+VRB *feed_view(Feed *feed);
+bool feed_read(Feed *feed, unsigned n, float *pow, unsigned *lost);
+unsigned feed_pending(Feed *feed);
+bool feed_intact(Feed *feed);
+int feed_fd(Feed *feed);
+bool feed_eof(Feed *feed);
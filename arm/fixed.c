@@ -0,0 +1,216 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#if defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#elif defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#include "freq.h"
+
+/*
+The fixed-point counterpart of autocorrelate_lags(), for history kept as int16
+rather than float. Half the bytes go through the cache per sample, and each
+vector holds twice as many samples: NEON's smlal and AVX2's vpmaddwd multiply
+int16s straight into int32 accumulators, in twice the lanes the float kernel
+gets. Anything else falls back to scalar C.
+
+The catch, as notes.md works out, is overflow. Each step adds two products per
+int32 lane, and two full-scale products already take a lane to the edge, so
+the int32 accumulators are flushed into int64 ones every so many steps. How
+many depends on how loud the signal actually is: a pass over f finds its peak,
+which is cheap next to the nac products per sample, and the flush interval is
+the most steps that can't overflow at that peak. Quiet signals (which is most
+of a note's decay) flush rarely; a signal hitting full scale flushes every
+step, and is merely no faster than the float kernel. Either way the sums are
+exact, and only become floating point once per lag, in the caller.
+
+Samples must be in [-INT16_MAX, INT16_MAX]; -32768 squared twice over doesn't
+fit. ingest() and decimate_s16() saturate to that.
+*/
+
+#define LAG_BLOCK 8
+
+
+#if defined(__ARM_NEON) && defined(__aarch64__)
+
+#define VLEN 8
+
+static void lag_block(
+    const int16_t *restrict f0, unsigned ndp, unsigned i, unsigned flush,
+    int64_t *restrict sums
+)
+{
+    int64x2_t wide[LAG_BLOCK];
+    for (unsigned l = 0; l < LAG_BLOCK; l++)
+        wide[l] = vdupq_n_s64(0);
+
+    const int16_t *y = f0 - i;
+    unsigned k = 0, vec_end = ndp - ndp%VLEN;
+    while (k < vec_end)
+    {
+        unsigned end = (vec_end - k)/VLEN > flush ? k + flush*VLEN : vec_end;
+        int32x4_t acc[LAG_BLOCK];
+        for (unsigned l = 0; l < LAG_BLOCK; l++)
+            acc[l] = vdupq_n_s32(0);
+
+        for (; k < end; k += VLEN)
+        {
+            int16x8_t x = vld1q_s16(f0 + k);
+            for (unsigned l = 0; l < LAG_BLOCK; l++)
+            {
+                int16x8_t v = vld1q_s16(y + k - l);
+                acc[l] = vmlal_s16(acc[l], vget_low_s16(x), vget_low_s16(v));
+                acc[l] = vmlal_high_s16(acc[l], x, v);
+            }
+        }
+
+        for (unsigned l = 0; l < LAG_BLOCK; l++)
+            wide[l] = vpadalq_s32(wide[l], acc[l]);
+    }
+
+    for (unsigned l = 0; l < LAG_BLOCK; l++)
+        sums[l] = vaddvq_s64(wide[l]);
+}
+
+#elif defined(__AVX2__)
+
+#define VLEN 16
+
+static __m256i widen(__m256i acc)
+{
+    return _mm256_add_epi64(
+        _mm256_cvtepi32_epi64(_mm256_castsi256_si128(acc)),
+        _mm256_cvtepi32_epi64(_mm256_extracti128_si256(acc, 1))
+    );
+}
+
+static int64_t hsum(__m256i v)
+{
+    __m128i s = _mm_add_epi64(
+        _mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1)
+    );
+    return _mm_cvtsi128_si64(s) + _mm_extract_epi64(s, 1);
+}
+
+static void lag_block(
+    const int16_t *restrict f0, unsigned ndp, unsigned i, unsigned flush,
+    int64_t *restrict sums
+)
+{
+    __m256i wide[LAG_BLOCK];
+    for (unsigned l = 0; l < LAG_BLOCK; l++)
+        wide[l] = _mm256_setzero_si256();
+
+    const int16_t *y = f0 - i;
+    unsigned k = 0, vec_end = ndp - ndp%VLEN;
+    while (k < vec_end)
+    {
+        unsigned end = (vec_end - k)/VLEN > flush ? k + flush*VLEN : vec_end;
+        __m256i acc[LAG_BLOCK];
+        for (unsigned l = 0; l < LAG_BLOCK; l++)
+            acc[l] = _mm256_setzero_si256();
+
+        for (; k < end; k += VLEN)
+        {
+            __m256i x = _mm256_loadu_si256((const __m256i*)(f0 + k));
+            for (unsigned l = 0; l < LAG_BLOCK; l++)
+            {
+                acc[l] = _mm256_add_epi32(acc[l], _mm256_madd_epi16(
+                    x, _mm256_loadu_si256((const __m256i*)(y + k - l))
+                ));
+            }
+        }
+
+        for (unsigned l = 0; l < LAG_BLOCK; l++)
+            wide[l] = _mm256_add_epi64(wide[l], widen(acc[l]));
+    }
+
+    for (unsigned l = 0; l < LAG_BLOCK; l++)
+        sums[l] = hsum(wide[l]);
+}
+
+#else
+
+#define VLEN 1
+
+static void lag_block(
+    const int16_t *restrict f0, unsigned ndp, unsigned i, unsigned flush,
+    int64_t *restrict sums
+)
+{
+    for (unsigned l = 0; l < LAG_BLOCK; l++)
+    {
+        int64_t s = 0;
+        for (unsigned k = 0; k < ndp; k++)
+            s += (int32_t)f0[k] * (f0 - i - l)[k];
+        sums[l] = s;
+    }
+}
+
+#endif
+
+
+static int64_t dot_tail(
+    const int16_t *f0, unsigned from, unsigned ndp, unsigned i
+)
+{
+    int64_t s = 0;
+    for (unsigned k = from; k < ndp; k++)
+        s += (int32_t)f0[k] * (f0 - i)[k];
+    return s;
+}
+
+
+/*
+How many vector steps the int32 accumulators can take before they have to be
+flushed, given that no sample's magnitude is over peak. Each step adds two
+products to each lane.
+*/
+static unsigned flush_steps(const int16_t *f, unsigned nf)
+{
+    int peak = 0;
+    for (unsigned k = 0; k < nf; k++)
+    {
+        int x = abs(f[k]);
+        if (x > peak)
+            peak = x;
+    }
+    assert(peak <= INT16_MAX);
+    return INT32_MAX / (2*(uint64_t)peak*peak + 1);
+}
+
+
+/*
+Lags [lo, hi) with the same layout as autocorrelate_lags(): f0 = f + nac and
+ndp = nf - nac. But sums[i] gets the sum of f0(k)*f0(k - i) added to it,
+exactly, rather than the mean.
+*/
+void autocorrelate_s16_lags(
+    const int16_t *f, unsigned nf, int64_t *sums, unsigned nac,
+    unsigned lo, unsigned hi
+)
+{
+    assert(nf > nac);
+    assert(lo <= hi && hi <= nac);
+
+    unsigned ndp = nf - nac,
+             vec_end = ndp - ndp%VLEN,
+             flush = flush_steps(f, nf);
+    const int16_t *f0 = f + nac;
+
+    unsigned i = lo;
+    for (; i + LAG_BLOCK <= hi; i += LAG_BLOCK)
+    {
+        int64_t block[LAG_BLOCK];
+        lag_block(f0, ndp, i, flush, block);
+        for (unsigned l = 0; l < LAG_BLOCK; l++)
+            sums[i + l] += block[l] + dot_tail(f0, vec_end, ndp, i + l);
+    }
+
+    // Leftover lags that don't fill a block
+    for (; i < hi; i++)
+        sums[i] += dot_tail(f0, 0, ndp, i);
+}
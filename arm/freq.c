@@ -1,16 +1,75 @@
 #include <assert.h>
 #include <float.h>
+#include <math.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <strings.h>
 #include <time.h>
+#include <unistd.h>
 
 #include <cblas.h>
+#include <fftw3.h>
 
 #include "freq.h"
+#include "pool.h"
+#include "util.h"
 
 #define PEAK_THRESHOLD 0x5p-3
 
+
+/*
+State for the FFT engine. Planning is slow and allocates, so it's done once per
+transform size by autocorrelate_plan() and every frame after that reuses the
+same plans and buffers. A few sizes are kept, since the multirate detector
+runs a different length in every band.
+*/
+#define FFT_PLANS 8
+
+typedef struct
+{
+    // What the buffers were last zero-padded for.
+    unsigned nf, nac, n;
+    // Real buffers, n long. x and y are only ever written up to ndp and nf
+    // respectively, so their zero padding survives between frames of the same
+    // lengths.
+    float *x, *y, *c;
+    // Half-spectra, n/2 + 1 long.
+    fftwf_complex *X, *Y;
+    fftwf_plan forward, inverse;
+} FftPlan;
+
+static FftPlan ffts[FFT_PLANS] = {0};
+// Which slot to plan into next when they're all in use.
+static unsigned fft_victim = 0;
+
+// Worker pool for the parallel engine, made on first use.
+static Pool *pool = NULL;
+
+static const struct
+{
+    const char *name;
+    AutocorrelateEngine engine;
+} engines[] = {
+    {"dot",      autocorrelate_dot},
+    {"fft",      autocorrelate_fft},
+    {"simd",     autocorrelate_simd},
+    {"parallel", autocorrelate_parallel},
+};
+
+// Behind autocorrelate(). The default is chosen at build time.
+static AutocorrelateEngine engine =
+#if defined(ENGINE_FFT)
+    autocorrelate_fft;
+#elif defined(ENGINE_SIMD)
+    autocorrelate_simd;
+#elif defined(ENGINE_PARALLEL)
+    autocorrelate_parallel;
+#else
+    autocorrelate_dot;
+#endif
+
 /*
 Calculate the autocorrelation, ac(t), of f(t). Mathematically,
 
@@ -40,6 +99,41 @@ f: 012.4...8...
            ^f0
 */
 void autocorrelate(float *f, unsigned nf, float *ac, unsigned nac)
+{
+    engine(f, nf, ac, nac);
+}
+
+
+/*
+Switch autocorrelate() over to the engine with the given name ("dot", "fft",
+"simd" or "parallel"), e.g. to compare them in the same binary. Returns false,
+changing nothing, if there's no such engine.
+*/
+bool autocorrelate_select(const char *name)
+{
+    for (unsigned e = 0; e < SALEN(engines); e++)
+    {
+        if (!strcasecmp(name, engines[e].name))
+        {
+            engine = engines[e].engine;
+            return true;
+        }
+    }
+    return false;
+}
+
+
+const char *autocorrelate_engine(void)
+{
+    for (unsigned e = 0; e < SALEN(engines); e++)
+        if (engine == engines[e].engine)
+            return engines[e].name;
+    assert(false);
+}
+
+
+// The original engine: one BLAS dot product per lag, O(nac*(nf - nac)).
+void autocorrelate_dot(float *f, unsigned nf, float *ac, unsigned nac)
 {
     assert(nf > nac);
     unsigned ndp = nf - nac;
@@ -57,6 +151,206 @@ void autocorrelate(float *f, unsigned nf, float *ac, unsigned nac)
 }
 
 
+static unsigned next_pow_2(unsigned x)
+{
+    unsigned p = 1;
+    while (p < x)
+        p <<= 1;
+    return p;
+}
+
+
+static void destroy_plan(FftPlan *p)
+{
+    if (p->forward)
+        fftwf_destroy_plan(p->forward);
+    if (p->inverse)
+        fftwf_destroy_plan(p->inverse);
+    fftwf_free(p->x);
+    fftwf_free(p->y);
+    fftwf_free(p->c);
+    fftwf_free(p->X);
+    fftwf_free(p->Y);
+    memset(p, 0, sizeof(FftPlan));
+}
+
+
+/*
+Find or make the plan for a given f and ac length, with its buffers padded for
+them. This is called implicitly by autocorrelate_fft(), but should be called
+ahead of time for every length that will be used, so that no frame pays for
+FFTW_MEASURE.
+*/
+static FftPlan *get_plan(unsigned nf, unsigned nac)
+{
+    assert(nf > nac);
+
+    /*
+    The products we want never wrap around a circular correlation as long as
+    the transform is at least nf long; see autocorrelate_fft(). Powers of two
+    are the fastest sizes for FFTW.
+    */
+    unsigned n = next_pow_2(nf);
+    FftPlan *p = NULL;
+    for (unsigned i = 0; i < FFT_PLANS && !p; i++)
+        if (ffts[i].n == n)
+            p = ffts + i;
+
+    if (!p)
+    {
+        for (unsigned i = 0; i < FFT_PLANS && !p; i++)
+            if (!ffts[i].n)
+                p = ffts + i;
+        if (!p)
+        {
+            p = ffts + fft_victim;
+            fft_victim = (fft_victim + 1) % FFT_PLANS;
+            destroy_plan(p);
+        }
+
+        p->n = n;
+        unsigned nc = n/2 + 1;
+        p->x = fftwf_alloc_real(n);
+        p->y = fftwf_alloc_real(n);
+        p->c = fftwf_alloc_real(n);
+        p->X = fftwf_alloc_complex(nc);
+        p->Y = fftwf_alloc_complex(nc);
+        assert(p->x && p->y && p->c && p->X && p->Y);
+
+        // Planning scribbles over the buffers; they're cleared below.
+        p->forward = fftwf_plan_dft_r2c_1d(n, p->x, p->X, FFTW_MEASURE);
+        p->inverse = fftwf_plan_dft_c2r_1d(n, p->X, p->c, FFTW_MEASURE);
+        assert(p->forward && p->inverse);
+    }
+    else if (p->nf == nf && p->nac == nac)
+        return p;
+
+    p->nf = nf;
+    p->nac = nac;
+    memset(p->x, 0, n*sizeof(float));
+    memset(p->y, 0, n*sizeof(float));
+    return p;
+}
+
+
+void autocorrelate_plan(unsigned nf, unsigned nac)
+{
+    get_plan(nf, nac);
+}
+
+
+void autocorrelate_deinit(void)
+{
+    if (pool)
+        pool_destroy(&pool);
+
+    for (unsigned i = 0; i < FFT_PLANS; i++)
+        destroy_plan(ffts + i);
+    fft_victim = 0;
+}
+
+
+/*
+Set how many threads the parallel engine uses, including the caller. 0 means
+one per CPU the pool may use (see pool_default_size()), which is also what you
+get without calling this. With only the caller, the work isn't split at all.
+*/
+void autocorrelate_threads(unsigned n)
+{
+    if (n == 0)
+        n = pool_default_size();
+    if (pool)
+    {
+        if (pool_size(pool) == n)
+            return;
+        pool_destroy(&pool);
+    }
+    pool = pool_create(n);
+}
+
+
+typedef struct
+{
+    const float *f;
+    float *ac;
+    unsigned nf, nac;
+} ParallelJob;
+
+
+/*
+Each thread gets a contiguous run of lags. Every lag costs the same ndp
+multiply-adds, so equal runs are equal work. Runs are rounded to 16 lags so
+that they start on the SIMD kernel's block boundaries and threads don't share
+the cache lines of ac that they write.
+*/
+static void parallel_task(void *arg, unsigned index, unsigned count)
+{
+    const ParallelJob *job = arg;
+    unsigned chunk = (job->nac + count - 1) / count;
+    chunk = (chunk + 15) & ~15u;
+
+    unsigned lo = index*chunk, hi = lo + chunk;
+    if (hi > job->nac)
+        hi = job->nac;
+    if (lo < hi)
+        autocorrelate_lags(job->f, job->nf, job->ac, job->nac, lo, hi);
+}
+
+
+// The SIMD engine with its lags split across a persistent pool of threads.
+void autocorrelate_parallel(float *f, unsigned nf, float *ac, unsigned nac)
+{
+    if (!pool)
+        autocorrelate_threads(0);
+
+    ParallelJob job = {.f = f, .ac = ac, .nf = nf, .nac = nac};
+    pool_run(pool, parallel_task, &job);
+}
+
+
+/*
+The same contract as autocorrelate_dot(), but computing every lag at once via
+the Wiener-Khinchin identity: correlation in time is multiplication by the
+conjugate in frequency. Our "autocorrelation" is really the cross-correlation
+of the tail x = f[nac:nf] against all of y = f, so
+
+c(m) = sum over k of x(k)*y(k + m) = IFFT(conj(X) * Y)(m), and
+ac(i) = c(nac - i)
+
+With x zero-padded past ndp, the largest index touched in y is
+ndp - 1 + nac = nf - 1, so a transform of n >= nf samples never wraps around
+and the result is exact (to rounding) rather than circular. The cost is three
+O(n log n) transforms regardless of nac.
+*/
+void autocorrelate_fft(float *f, unsigned nf, float *ac, unsigned nac)
+{
+    FftPlan *p = get_plan(nf, nac);
+
+    unsigned ndp = nf - nac, nc = p->n/2 + 1;
+    memcpy(p->x, f + nac, ndp*sizeof(float));
+    memcpy(p->y, f, nf*sizeof(float));
+
+    fftwf_execute_dft_r2c(p->forward, p->x, p->X);
+    fftwf_execute_dft_r2c(p->forward, p->y, p->Y);
+
+    for (unsigned i = 0; i < nc; i++)
+    {
+        float a = p->X[i][0], b = p->X[i][1],
+              c = p->Y[i][0], d = p->Y[i][1];
+        p->X[i][0] = a*c + b*d;
+        p->X[i][1] = a*d - b*c;
+    }
+
+    fftwf_execute(p->inverse);
+
+    // FFTW doesn't normalise, so the 1/n is folded in with the 1/ndp.
+    float scale = 1.f / ((float)p->n * ndp);
+    const float *c = p->c + nac;
+    for (unsigned i = 0; i < nac; i++)
+        ac[i] += c[-(int)i]*scale;
+}
+
+
 /*
 Calculate the x coordinate of the peak of a parabola passing through points
 (-1, a), (0, b), and (1, c).
@@ -67,6 +361,23 @@ static float parafit(float a, float b, float c)
 }
 
 
+/*
+Fit the peak whose region above threshold spans lags i to k, and return the
+frequency it's the period of. ac[i - 1] and ac[k + 1] are read too if the
+peak is only a lag wide.
+*/
+static float peak_fit(const float *ac, unsigned i, unsigned k, unsigned rate)
+{
+    unsigned j = (i + k)/2;
+    // A peak only a lag or two wide (high notes, decimated bands) is fitted to
+    // its neighbours.
+    unsigned dj = j > i ? j - i : 1;
+    // Hope that the AC is mostly just a parabola between i and k.
+    float jfit = (float)j + (float)dj * parafit(ac[j - dj], ac[j], ac[j + dj]);
+    return (float)rate / jfit;
+}
+
+
 float freq(float *ac, unsigned nac, unsigned rate)
 {
     unsigned i = 1;
@@ -99,9 +410,39 @@ float freq(float *ac, unsigned nac, unsigned rate)
         k++;
     }
     k--;
-    unsigned j = (i + k)/2;
-    unsigned dj = j - i;
-    // Hope that the AC is mostly just a parabola between i and k.
-    float jfit = (float)j + (float)dj * parafit(ac[j - dj], ac[j], ac[j + dj]);
-    return (float)rate / jfit;
+    return peak_fit(ac, i, k, rate);
+}
+
+
+/*
+Like freq(), but only looking for the peak between lags lo and hi, for when the
+note is known to be close to rate/lo..rate/hi. Nothing outside of them, apart
+from ac[0], is read, so nothing else needs calculating.
+*/
+float freq_window(const float *ac, unsigned lo, unsigned hi, unsigned rate)
+{
+    assert(lo < hi);
+    unsigned m = lo;
+    for (unsigned i = lo + 1; i < hi; i++)
+        if (ac[i] > ac[m])
+            m = i;
+
+    // A maximum on the edge is the slope of a peak outside the window.
+    float thr = PEAK_THRESHOLD*ac[0];
+    if (ac[m] <= thr || m == lo || m == hi - 1)
+        return -1;
+
+    unsigned i = m, k = m;
+    while (i > lo + 1 && ac[i - 1] > thr)
+        i--;
+    while (k + 2 < hi && ac[k + 1] > thr)
+        k++;
+    return peak_fit(ac, i, k, rate);
+}
+
+
+// The frequency of a key, numbered from 0 for A0 to N_NOTES - 1 for C8.
+float freq_of_key(unsigned key)
+{
+    return FMIN * pow(SEMI, key);
 }
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <stdbool.h>
 #include <stdint.h>
 
 // 2**(1/12)
@@ -19,5 +20,31 @@ fsamp = 44.1 kHz  tsamp = 22.676 us
 samples_min = fsamp / fmin = 1604
 */
 
+typedef void (*AutocorrelateEngine)(
+    float *f, unsigned nf, float *ac, unsigned nac
+);
+
+// Uses whichever engine was chosen at build time (make ENGINE=DOT, FFT, SIMD
+// or PARALLEL), unless another has been selected since.
 void autocorrelate(float *f, unsigned nf, float *ac, unsigned nac);
+bool autocorrelate_select(const char *name);
+const char *autocorrelate_engine(void);
+void autocorrelate_dot(float *f, unsigned nf, float *ac, unsigned nac);
+void autocorrelate_fft(float *f, unsigned nf, float *ac, unsigned nac);
+void autocorrelate_simd(float *f, unsigned nf, float *ac, unsigned nac);
+void autocorrelate_parallel(float *f, unsigned nf, float *ac, unsigned nac);
+void autocorrelate_lags(
+    const float *f, unsigned nf, float *ac, unsigned nac,
+    unsigned lo, unsigned hi
+);
+void autocorrelate_s16_lags(
+    const int16_t *f, unsigned nf, int64_t *sums, unsigned nac,
+    unsigned lo, unsigned hi
+);
+void autocorrelate_plan(unsigned nf, unsigned nac);
+void autocorrelate_threads(unsigned n);
+void autocorrelate_deinit(void);
+
 float freq(float *ac, unsigned nac, unsigned rate);
+float freq_window(const float *ac, unsigned lo, unsigned hi, unsigned rate);
+float freq_of_key(unsigned key);
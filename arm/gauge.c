@@ -3,16 +3,44 @@
 #include <fcntl.h>
 #include <linux/spi/spidev.h>
 #include <math.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <sys/uio.h>
 #include <time.h>
 #include <unistd.h>
 
 #include "gauge.h"
+#include "prof.h"
+#include "reactor.h"
+#include "rt.h"
+
+/*
+Each SPI transfer is a blocking ioctl of several hundred microseconds at 1 MHz,
+which analysis shouldn't have to wait for. So readings are posted to a
+single-slot mailbox that always holds only the latest one, and a thread of the
+gauges' own takes whatever is there GAUGE_REFRESH times a second. Posting is
+one atomic store: no lock, no syscall, and nothing to wait for. Readings posted
+between refreshes just replace each other, and a refresh whose quantised
+channels are the same as last time sends nothing.
+
+What does get sent is only the channels that changed. Each channel's first
+byte carries its DAC index (see pic/receive.inc), so the receiver doesn't need
+them all, or in order. A refresh's changed channels go out as one
+spi_ioc_transfer each, all in one ioctl. Once a second everything is sent
+regardless, so that the receiver can't drift for long if it missed something,
+and so that its watchdog hears from us even when the reading holds still.
+
+Instead of SPI, the same bytes can be written to any file descriptor: a pipe
+to the stand-in receiver in receiver.c, say, or a FIFO. Then a refresh's
+channels go out in one writev() rather than one ioctl.
+*/
 
 
 #define DEV_FILENAME "/dev/spidev0.0"
@@ -25,12 +53,58 @@ const uint16_t
     CH5_MASK = CH1_MASK;
 const uint8_t CH4_MASK = (1 << 5) - 1;
 
+// How often, in Hz, the gauge thread sends the latest reading.
+#define GAUGE_REFRESH 30
+// Set in the mailbox while it holds a reading that hasn't been taken.
+#define MAILBOX_FULL (1ull << 63)
+/*
+Refreshes between sending every channel, changed or not. Skipping unchanged
+readings leans on this: the PIC's watchdog (init_watchdog in pic/main.asm) is
+only fed by bytes coming in, and resets the board after 8 s without any, so
+this has to stay well short of 8 s.
+*/
+#define KEEPALIVE_REFRESHES GAUGE_REFRESH
+#define N_CHANNELS 4
+
+
+// Quantised channel values, as sent.
+typedef struct
+{
+    uint16_t u1, u2, u5;
+    uint8_t u4;
+} Channels;
+
+
+// One channel's bytes, as the receiver takes them.
+typedef struct
+{
+    uint8_t bytes[2];
+    uint8_t len;
+} Frame;
+
 
 struct GaugeContextTag
 {
     uint32_t mode, speed;
     uint8_t word_bits;
     int fd;
+    // Whether fd is spidev, or just somewhere to write the bytes.
+    bool spi;
+
+    // The latest posted reading, packed by pack(), with MAILBOX_FULL set.
+    _Atomic uint64_t mailbox;
+    pthread_t thread;
+    _Atomic bool stop;
+
+    // The gauge thread's own: the latest reading it took, what it last sent
+    // of each channel, and how many refreshes ago it last sent them all.
+    uint64_t last;
+    Frame frames[N_CHANNELS];
+    bool sent_any;
+    unsigned since_all;
+
+    // Written by the gauge thread, readable from any.
+    _Atomic unsigned long transfers, bytes_sent, bytes_skipped;
 };
 
 
@@ -55,11 +129,219 @@ static void check_c(bool bad, const char *message)
 }
 
 
+static Channels quantise(
+    float db, float octave, float semitone, float deviation
+)
+{
+    return (Channels){
+        .u1 = octave*CH1_MASK,
+        .u2 = db*CH2_MASK,
+        .u5 = deviation*CH5_MASK,
+        .u4 = semitone*CH4_MASK,
+    };
+}
+
+
+// All four channels fit in 35 bits, so a whole reading moves atomically.
+static uint64_t pack(Channels c)
+{
+    return (uint64_t)(c.u1 & CH1_MASK)
+         | (uint64_t)(c.u2 & CH2_MASK) << 10
+         | (uint64_t)(c.u5 & CH5_MASK) << 20
+         | (uint64_t)(c.u4 & CH4_MASK) << 30;
+}
+
+
+static Channels unpack(uint64_t p)
+{
+    return (Channels){
+        .u1 = p & CH1_MASK,
+        .u2 = p >> 10 & CH2_MASK,
+        .u5 = p >> 20 & CH5_MASK,
+        .u4 = p >> 30 & CH4_MASK,
+    };
+}
+
+
+static Frame frame_10b(unsigned index, uint16_t u)
+{
+    return (Frame){.bytes = {(index << INDEX_POS) | (u >> 8), u}, .len = 2};
+}
+
+static Frame frame_5b(unsigned index, uint8_t u)
+{
+    return (Frame){.bytes = {(index << INDEX_POS) | u}, .len = 1};
+}
+
+static void encode(Channels c, Frame *frames)
+{
+    frames[0] = frame_10b(1, c.u1);
+    frames[1] = frame_10b(2, c.u2);
+    frames[2] = frame_10b(5, c.u5);
+    frames[3] = frame_5b(4, c.u4);
+}
+
+
+/*
+Send the frames whose send flag is set, in one ioctl or writev(). Returns how
+many bytes that was.
+*/
+static unsigned transfer(
+    const GaugeContext *ctx, const Frame *frames, const bool *send,
+    const char *message
+)
+{
+    struct spi_ioc_transfer transfers[N_CHANNELS];
+    struct iovec iov[N_CHANNELS];
+    unsigned n_transfers = 0, bytes = 0;
+    for (unsigned i = 0; i < N_CHANNELS; i++)
+    {
+        if (!send[i])
+            continue;
+        transfers[n_transfers] = (struct spi_ioc_transfer){
+            .tx_buf = (uint64_t)frames[i].bytes,
+            .len = frames[i].len
+        };
+        iov[n_transfers] = (struct iovec){
+            .iov_base = (void*)frames[i].bytes,
+            .iov_len = frames[i].len
+        };
+        n_transfers++;
+        bytes += frames[i].len;
+    }
+    if (!n_transfers)
+        return 0;
+
+    PROF_BEGIN(PROF_GAUGE);
+    if (ctx->spi)
+    {
+        warn_c(
+            ioctl(ctx->fd, SPI_IOC_MESSAGE(n_transfers), transfers) == -1,
+            message
+        );
+    }
+    else
+        warn_c(writev(ctx->fd, iov, n_transfers) != bytes, message);
+    PROF_END(PROF_GAUGE);
+    return bytes;
+}
+
+
+// Every channel, whatever was sent before.
+static void send(const GaugeContext *ctx, Channels c)
+{
+    Frame frames[N_CHANNELS];
+    encode(c, frames);
+    const bool all[N_CHANNELS] = {true, true, true, true};
+    transfer(ctx, frames, all, "Failed to transfer SPI message");
+}
+
+
+// Only the channels that differ from what the gauge thread sent last, unless
+// all is set.
+static void send_changes(GaugeContext *ctx, Channels c, bool all)
+{
+    Frame frames[N_CHANNELS];
+    encode(c, frames);
+
+    bool changed[N_CHANNELS];
+    unsigned skipped = 0;
+    for (unsigned i = 0; i < N_CHANNELS; i++)
+    {
+        changed[i] = all || memcmp(
+            frames + i, ctx->frames + i, sizeof(Frame)
+        );
+        if (!changed[i])
+            skipped += frames[i].len;
+    }
+
+    unsigned bytes = transfer(
+        ctx, frames, changed, "Failed to transfer SPI changes"
+    );
+    if (bytes)
+        atomic_fetch_add_explicit(&ctx->transfers, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&ctx->bytes_sent, bytes, memory_order_relaxed);
+    atomic_fetch_add_explicit(
+        &ctx->bytes_skipped, skipped, memory_order_relaxed
+    );
+
+    memcpy(ctx->frames, frames, sizeof(frames));
+    if (all)
+        ctx->since_all = 0;
+    ctx->sent_any = true;
+}
+
+
+/*
+Take the mailbox's reading, if there's a new one, and send whatever changed.
+With nothing new, the last reading still goes out again in full when the
+keepalive is due.
+*/
+static bool on_refresh(int fd, uint32_t events, void *arg)
+{
+    GaugeContext *ctx = arg;
+    uint64_t p = atomic_exchange_explicit(
+        &ctx->mailbox, 0, memory_order_acquire
+    );
+    bool full = p & MAILBOX_FULL;
+    if (!full && !ctx->sent_any)
+        return true;
+
+    bool all = !ctx->sent_any || ++ctx->since_all >= KEEPALIVE_REFRESHES;
+    if (full)
+        ctx->last = p & ~MAILBOX_FULL;
+    else if (!all)
+        return true;
+
+    send_changes(ctx, unpack(ctx->last), all);
+    return true;
+}
+
+
+static void *gauge_thread(void *arg)
+{
+    GaugeContext *ctx = arg;
+
+    // SIGINT is for the main thread to deal with.
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+    Reactor *reactor = reactor_create();
+    reactor_timer(reactor, 1./GAUGE_REFRESH, on_refresh, ctx);
+    rt_enter(RT_GAUGE);
+    while (!atomic_load_explicit(&ctx->stop, memory_order_relaxed))
+        reactor_run(reactor, -1);
+    rt_leave(RT_GAUGE);
+    reactor_destroy(&reactor);
+    return NULL;
+}
+
+
+// Everything but the handle, which is already open, then the thread.
+static GaugeContext *start(GaugeContext *ctx)
+{
+    atomic_init(&ctx->mailbox, 0);
+    atomic_init(&ctx->stop, false);
+    atomic_init(&ctx->transfers, 0);
+    atomic_init(&ctx->bytes_sent, 0);
+    atomic_init(&ctx->bytes_skipped, 0);
+    ctx->sent_any = false;
+    ctx->since_all = 0;
+    assert(pthread_create(&ctx->thread, NULL, gauge_thread, ctx) == 0);
+
+    return ctx;
+}
+
+
+// The gauges on the Pi's SPI bus.
 GaugeContext *gauge_init(void)
 {
     GaugeContext *ctx = malloc(sizeof(GaugeContext));
     assert(ctx);
 
+    ctx->spi = true;
     ctx->fd = open(DEV_FILENAME, O_WRONLY);
     check_c(ctx->fd == -1, "Failed to open SPI handle for " DEV_FILENAME);
 
@@ -98,10 +380,28 @@ GaugeContext *gauge_init(void)
         ctx->speed = orig_speed;
     }
 
-    return ctx;
+    return start(ctx);
 }
 
 
+/*
+Gauges whose bytes are written to fd instead, exactly as they'd go over SPI.
+The gauge closes fd when it's deinitialised.
+*/
+GaugeContext *gauge_init_stream(int fd)
+{
+    GaugeContext *ctx = malloc(sizeof(GaugeContext));
+    assert(ctx);
+    ctx->spi = false;
+    ctx->fd = fd;
+    return start(ctx);
+}
+
+
+/*
+Send a reading straight away, waiting for the transfer. This always sends every
+channel, and isn't counted in gauge_stats().
+*/
 void gauge_message(
     const GaugeContext *ctx,
     float db,
@@ -110,48 +410,67 @@ void gauge_message(
     float deviation
 )
 {
-    uint16_t u1 = octave*CH1_MASK,
-             u2 = db*CH2_MASK,
-             u5 = deviation*CH5_MASK;
-    uint8_t u4 = semitone*CH4_MASK;
-
-    const uint8_t message[] = {
-        (1 << INDEX_POS) | (u1 >> 8),
-        u1,
-        (2 << INDEX_POS) | (u2 >> 8),
-        u2,
-        (5 << INDEX_POS) | (u5 >> 8),
-        u5,
-        (4 << INDEX_POS) | u4
-    };
+    send(ctx, quantise(db, octave, semitone, deviation));
+}
 
-    struct spi_ioc_transfer transfer =
-    {
-        .tx_buf = (uint64_t)message,
-        .len = sizeof(message)
-    };
 
-    const int n_messages = 1;
+/*
+Leave a reading for the gauge thread to send at its next refresh, replacing
+any that it hasn't got to yet. Never blocks.
+*/
+void gauge_post(
+    GaugeContext *ctx,
+    float db,
+    float octave,
+    float semitone,
+    float deviation
+)
+{
+    uint64_t p = pack(quantise(db, octave, semitone, deviation));
+    atomic_store_explicit(&ctx->mailbox, p | MAILBOX_FULL, memory_order_release);
+}
+
 
-    warn_c(
-        ioctl(
-            ctx->fd,
-            SPI_IOC_MESSAGE(n_messages),
-            &transfer
-        ) == -1,
-        "Failed to transfer SPI message"
-    );
+// What the gauge thread has sent so far, and what it saved.
+GaugeStats gauge_stats(const GaugeContext *ctx)
+{
+    return (GaugeStats){
+        .transfers = atomic_load_explicit(
+            &ctx->transfers, memory_order_relaxed
+        ),
+        .bytes_sent = atomic_load_explicit(
+            &ctx->bytes_sent, memory_order_relaxed
+        ),
+        .bytes_skipped = atomic_load_explicit(
+            &ctx->bytes_skipped, memory_order_relaxed
+        ),
+    };
 }
 
 
-void gauge_deinit(GaugeContext **ctx)
+/*
+Stop the gauge thread and close the gauges. Returns everything the thread sent,
+including whatever it sent on its way out, which gauge_stats() beforehand
+wouldn't have counted.
+*/
+GaugeStats gauge_deinit(GaugeContext **ctx)
 {
-    warn_c(close((*ctx)->fd) == -1, "Failed to close SPI handle");
+    // It notices within a refresh.
+    atomic_store_explicit(&(*ctx)->stop, true, memory_order_relaxed);
+    assert(pthread_join((*ctx)->thread, NULL) == 0);
+    GaugeStats stats = gauge_stats(*ctx);
+    printf(
+        "Gauge SPI: %lu transfers, %lu bytes sent, %lu unchanged bytes skipped\n",
+        stats.transfers, stats.bytes_sent, stats.bytes_skipped
+    );
+
+    warn_c(close((*ctx)->fd) == -1, "Failed to close gauge handle");
 
     free(*ctx);
     *ctx = NULL;
 
     puts("Gauges deinitialized");
+    return stats;
 }
 
 
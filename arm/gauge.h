@@ -7,8 +7,16 @@ struct GaugeContextTag;
 typedef struct GaugeContextTag GaugeContext;
 
 
+typedef struct
+{
+    // ioctls made, and channel bytes sent, and left out for being unchanged.
+    unsigned long transfers, bytes_sent, bytes_skipped;
+} GaugeStats;
+
+
 GaugeContext *gauge_init(void);
-void gauge_deinit(GaugeContext**);
+GaugeContext *gauge_init_stream(int fd);
+GaugeStats gauge_deinit(GaugeContext**);
 
 void gauge_message(
     const GaugeContext *ctx,
@@ -17,6 +25,15 @@ void gauge_message(
     float semitone,
     float deviation
 );
+void gauge_post(
+    GaugeContext *ctx,
+    float db,
+    float octave,
+    float semitone,
+    float deviation
+);
+
+GaugeStats gauge_stats(const GaugeContext *ctx);
 
 void gauge_demo(const GaugeContext *ctx);
 
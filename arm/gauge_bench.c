@@ -0,0 +1,149 @@
+#include <assert.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "gauge.h"
+#include "receiver.h"
+#include "util.h"
+
+/*
+Post readings to the gauges as fast as -r says, for -s seconds, with the
+stand-in receiver in place of the PIC, and report what arrived: how often the
+gauges actually moved, how long a reading took from gauge_post() to its DAC
+load, how many readings were coalesced away by the mailbox, and whether any
+bytes went missing or failed to decode.
+
+The dB channel (DAC 2) counts posts modulo 1024, so every post changes it and
+every load of it says which post it came from. The octave channel (DAC 1)
+counts every 64th post, and the other two hold still, which is about how a
+real note goes: the level always jitters, the rest rarely change.
+
+Usage: gauge_bench [-r posts per second] [-s seconds]
+*/
+
+#define VALUES 1024
+
+
+// The value for DAC 2 or DAC 1 that comes out of gauge.c's quantisation.
+static float level(unsigned count)
+{
+    return (count % VALUES + 0.5f) / (VALUES - 1);
+}
+
+
+static void sleep_until(double t)
+{
+    struct timespec ts = {
+        .tv_sec = (time_t)t,
+        .tv_nsec = (long)(fmod(t, 1)*1e9),
+    };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL));
+}
+
+
+int main(int argc, char **argv)
+{
+    double rate = 1000, seconds = 3;
+    int opt;
+    while ((opt = getopt(argc, argv, "r:s:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'r': rate = atof(optarg); break;
+            case 's': seconds = atof(optarg); break;
+            default:
+                fprintf(
+                    stderr, "Usage: %s [-r posts per second] [-s seconds]\n",
+                    argv[0]
+                );
+                return 1;
+        }
+    }
+    assert(rate > 0 && seconds > 0);
+
+    unsigned n_posts = rate*seconds;
+    double *posted = malloc(n_posts*sizeof(double));
+    assert(posted);
+
+    // Far more than enough: even sending everything every post
+    Receiver *receiver = receiver_create(4*n_posts + 64);
+    GaugeContext *gauge = gauge_init_stream(receiver_fd(receiver));
+
+    double start = monotonic();
+    for (unsigned i = 0; i < n_posts; i++)
+    {
+        sleep_until(start + i/rate);
+        posted[i] = monotonic();
+        gauge_post(gauge, level(i), level(i/64), 0.25f, 0.75f);
+    }
+    // Let the last post go out before the gauge is stopped.
+    usleep(100000);
+
+    // Only once the thread's gone, since it may send once more on its way out
+    GaugeStats sent = gauge_deinit(&gauge);
+    receiver_stop(receiver);
+    ReceiverStats received = receiver_stats(receiver);
+
+    /*
+    Match each load of DAC 2 to the latest post of that value made before it
+    arrived. Posts are VALUES apart, far longer than any reading takes to get
+    through, so that's unambiguous.
+    */
+    unsigned n_log, shown = 0, latest = 0;
+    const ReceiverUpdate *log = receiver_log(receiver, &n_log);
+    double total_latency = 0, worst_latency = 0;
+    int last_shown = -1;
+    for (unsigned u = 0; u < n_log; u++)
+    {
+        if (log[u].index != 2)
+            continue;
+        while (latest + 1 < n_posts && posted[latest + 1] <= log[u].time)
+            latest++;
+        int i = latest;
+        while (i >= 0 && i % VALUES != log[u].value)
+            i--;
+        // Resent by the keepalive, not shown afresh
+        if (i < 0 || i == last_shown)
+            continue;
+
+        double latency = log[u].time - posted[i];
+        total_latency += latency;
+        if (latency > worst_latency)
+            worst_latency = latency;
+        last_shown = i;
+        shown++;
+    }
+
+    unsigned last = n_posts - 1;
+    bool final_ok = receiver_dac(receiver, 2) == last % VALUES
+                 && receiver_dac(receiver, 1) == last/64 % VALUES;
+
+    printf(
+        "%u posts at %.0f/s over %.1f s\n"
+        "%u shown (%.1f/s), %u coalesced (%.1f%%)\n"
+        "post to load: %.2f ms mean, %.2f ms worst\n"
+        "%lu transfers, %lu bytes sent, %lu unchanged bytes skipped "
+        "(%.2f bytes per transfer)\n"
+        "received %lu bytes, %lu loads, %lu bad checks, %lu strays; "
+        "%ld bytes lost\n"
+        "final reading %s\n",
+        n_posts, rate, seconds,
+        shown, shown/seconds, n_posts - shown,
+        100.*(n_posts - shown)/n_posts,
+        shown ? 1e3*total_latency/shown : NAN, 1e3*worst_latency,
+        sent.transfers, sent.bytes_sent, sent.bytes_skipped,
+        sent.transfers ? (double)sent.bytes_sent/sent.transfers : 0,
+        received.bytes, received.updates, received.bad_checks,
+        received.strays, (long)(sent.bytes_sent - received.bytes),
+        final_ok ? "matches" : "DOESN'T MATCH"
+    );
+
+    receiver_destroy(&receiver);
+    free(posted);
+    return final_ok && !received.bad_checks && !received.strays
+        && received.bytes == sent.bytes_sent ? 0 : 1;
+}
@@ -0,0 +1,238 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "freq.h"
+#include "iac.h"
+
+
+IAC *iac_create(unsigned nac, unsigned window, VRBFormat format)
+{
+    IAC *a = malloc(sizeof(IAC));
+    assert(a);
+
+    a->nac = nac;
+    a->window = window;
+    a->format = format;
+    a->lo = 0;
+    a->hi = nac;
+    a->sums = malloc(nac*sizeof(double));
+    a->scratch = NULL;
+    a->iscratch = NULL;
+    if (format == VRB_S16)
+        a->iscratch = malloc(nac*sizeof(int64_t));
+    else
+        a->scratch = malloc(nac*sizeof(float));
+    assert(a->sums && (a->scratch || a->iscratch));
+
+    iac_reset(a);
+    return a;
+}
+
+
+void iac_destroy(IAC *a)
+{
+    free(a->sums);
+    free(a->scratch);
+    free(a->iscratch);
+    free(a);
+}
+
+
+// Forget every sample summed so far, e.g. at the start of a new note.
+void iac_reset(IAC *a)
+{
+    a->count = 0;
+    memset(a->sums, 0, a->nac*sizeof(double));
+}
+
+
+// Add scratch, which is averages over n samples, into the sums of lags lo..hi.
+static void add_lags(IAC *a, unsigned lo, unsigned hi, unsigned n, double sign)
+{
+    for (unsigned i = lo; i < hi; i++)
+        a->sums[i] += sign*n*a->scratch[i];
+}
+
+
+/*
+accumulate() for int16 history. The kernel's sums come out exact, and are far
+inside the 53 bits that a double holds exactly, so the running sums never pick
+up rounding error either; the products only turn into floating point here,
+once per lag.
+*/
+static void accumulate_s16(
+    IAC *a, VRB *b, size_t back, unsigned n, double sign
+)
+{
+    unsigned nf = a->nac + n;
+    const int16_t *f = vrb_past(b, (back + a->nac)*sizeof(int16_t));
+
+    if (a->lo > 0)
+    {
+        a->iscratch[0] = 0;
+        autocorrelate_s16_lags(f, nf, a->iscratch, a->nac, 0, 1);
+        a->sums[0] += sign*a->iscratch[0];
+    }
+    memset(a->iscratch + a->lo, 0, (a->hi - a->lo)*sizeof(int64_t));
+    autocorrelate_s16_lags(f, nf, a->iscratch, a->nac, a->lo, a->hi);
+    for (unsigned i = a->lo; i < a->hi; i++)
+        a->sums[i] += sign*a->iscratch[i];
+}
+
+
+/*
+Add (sign = 1) or remove (sign = -1) the products of the n samples that end
+back samples before b's present, each against the nac samples before it. This
+is exactly one call to autocorrelate() over a contiguous view of the VRB, so it
+costs O(nac*n) with whichever engine was built in, and never copies the
+history. With a narrowed set of lags, only those and lag 0 are done, directly.
+*/
+static void accumulate(IAC *a, VRB *b, size_t back, unsigned n, double sign)
+{
+    if (a->format == VRB_S16)
+    {
+        accumulate_s16(a, b, back, n, sign);
+        return;
+    }
+
+    unsigned nf = a->nac + n;
+    float *f = (float*)vrb_past(b, (back + a->nac)*sizeof(float));
+
+    if (a->lo == 0 && a->hi == a->nac)
+    {
+        memset(a->scratch, 0, a->nac*sizeof(float));
+        autocorrelate(f, nf, a->scratch, a->nac);
+        // autocorrelate() averages; undo that to get sums.
+        add_lags(a, 0, a->nac, n, sign);
+        return;
+    }
+
+    if (a->lo > 0)
+    {
+        a->scratch[0] = 0;
+        autocorrelate_lags(f, nf, a->scratch, a->nac, 0, 1);
+        add_lags(a, 0, 1, n, sign);
+    }
+    memset(a->scratch + a->lo, 0, (a->hi - a->lo)*sizeof(float));
+    autocorrelate_lags(f, nf, a->scratch, a->nac, a->lo, a->hi);
+    add_lags(a, a->lo, a->hi, n, sign);
+}
+
+
+/*
+Account for n new samples that have just been written to b and advanced past.
+If that takes the window over its length, the oldest samples are dropped. b
+must hold samples in the IAC's format and be long enough to reach back over
+the whole window, the new samples and the lags: window + n + nac samples.
+*/
+void iac_update(IAC *a, VRB *b, unsigned n)
+{
+    assert(n > 0);
+    accumulate(a, b, n, n, 1);
+    a->count += n;
+
+    if (a->window && a->count > a->window)
+    {
+        unsigned drop = a->count - a->window;
+        // The oldest summed sample is now count samples in the past.
+        assert(
+            (a->count + a->nac)*vrb_format_size(a->format) <= b->length
+        );
+        accumulate(a, b, a->count, drop, -1);
+        a->count = a->window;
+    }
+}
+
+
+/*
+Start again from the n samples before b's present, as though they'd arrived
+chunk at a time, so that every autocorrelate() call is the same length as the
+regular updates (and, for the FFT engine, uses the same plan). n should be no
+more than the window.
+*/
+void iac_prime(IAC *a, VRB *b, unsigned n, unsigned chunk)
+{
+    iac_reset(a);
+    for (unsigned back = n; back > 0;)
+    {
+        unsigned m = back < chunk ? back : chunk;
+        accumulate(a, b, back, m, 1);
+        a->count += m;
+        back -= m;
+    }
+}
+
+
+/*
+Only sum lag 0 and lags [lo, hi) from now on, or all of them again if that's
+[0, nac). The window starts again, since the sums of any lags newly added
+would be missing what came before.
+*/
+void iac_set_lags(IAC *a, unsigned lo, unsigned hi)
+{
+    assert(lo < hi && hi <= a->nac);
+    a->lo = lo;
+    a->hi = hi;
+    iac_reset(a);
+}
+
+
+/*
+Write the autocorrelation of the current window to ac, which must be nac long.
+It's averaged over the window, with the same scale as autocorrelate(). Lags
+that aren't being summed read as 0.
+*/
+void iac_read(const IAC *a, float *ac)
+{
+    assert(a->count > 0);
+    double scale = 1. / a->count;
+    for (unsigned i = 0; i < a->nac; i++)
+        ac[i] = a->sums[i]*scale;
+}
+
+
+static double square_at(const void *f, VRBFormat format, unsigned i)
+{
+    double x = format == VRB_S16
+        ? ((const int16_t*)f)[i] : ((const float*)f)[i];
+    return x*x;
+}
+
+
+/*
+Like iac_read(), but write the normalised square difference function (McLeod's
+NSDF) of the window instead:
+
+nsdf[i] = 2*sums[i] / m(i), where
+m(i) = sum over the window of f(k)^2 + f(k - i)^2
+
+That's 1 at lag 0 and within [-1, 1] everywhere, and it isn't biased towards
+short lags the way the raw autocorrelation is when the window's partners reach
+back before the note: the energy they lack drops out of m too. So a peak is
+there in full as soon as the window holds a couple of cycles, rather than once
+the history has filled.
+
+m(0) is twice sums[0], and each lag after that only swaps the square of the
+sample that's newly reached at the back for the one that's left at the front,
+so this costs O(nac) on top of the lag sums, whatever the window. b must be the
+VRB the sums were last updated from, with nothing written to it since.
+*/
+void iac_read_nsdf(const IAC *a, VRB *b, float *nsdf)
+{
+    assert(a->count > 0);
+    const void *f = vrb_past(
+        b, (a->count + a->nac)*vrb_format_size(a->format)
+    );
+
+    // The window is f[nac, nac + count); its partners at lag i, that less i.
+    double back = a->sums[0];
+    nsdf[0] = 1;
+    for (unsigned i = 1; i < a->nac; i++)
+    {
+        back += square_at(f, a->format, a->nac - i)
+              - square_at(f, a->format, a->nac + a->count - i);
+        double m = a->sums[0] + back;
+        nsdf[i] = m > 0 ? 2*a->sums[i]/m : 0;
+    }
+}
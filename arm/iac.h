@@ -0,0 +1,39 @@
+#pragma once
+
+#include "vrb.h"
+
+// An incremental autocorrelator. Rather than recomputing the autocorrelation
+// of the whole history every period, it keeps running lag sums over a sliding
+// window of samples, adding the products for samples as they arrive and
+// subtracting them again as they leave the window.
+typedef struct {
+    // Number of lags.
+    unsigned nac;
+    // What the VRBs given to it hold. For VRB_S16, the fixed-point kernel
+    // does the sums.
+    VRBFormat format;
+    // Number of samples whose products are kept in the sums. 0 means that
+    // nothing is ever dropped.
+    unsigned window;
+    // Number of samples currently in the sums.
+    unsigned count;
+    // Lags summed besides lag 0: [lo, hi). All of them unless iac_set_lags()
+    // has narrowed them down.
+    unsigned lo, hi;
+    // sums[i] = sum over the window of f(k)*f(k - i). Double, because these
+    // are added to and subtracted from for the whole length of a note.
+    double *sums;
+    // Per-update autocorrelate() output, nac long. For VRB_S16, iscratch
+    // instead, which gets exact integer sums.
+    float *scratch;
+    int64_t *iscratch;
+} IAC;
+
+IAC *iac_create(unsigned nac, unsigned window, VRBFormat format);
+void iac_destroy(IAC *a);
+void iac_reset(IAC *a);
+void iac_update(IAC *a, VRB *b, unsigned n);
+void iac_prime(IAC *a, VRB *b, unsigned n, unsigned chunk);
+void iac_set_lags(IAC *a, unsigned lo, unsigned hi);
+void iac_read(const IAC *a, float *ac);
+void iac_read_nsdf(const IAC *a, VRB *b, float *nsdf);
@@ -0,0 +1,324 @@
+#include <assert.h>
+#include <math.h>
+#include <stdbool.h>
+
+#if defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#elif defined(__AVX2__) && defined(__FMA__)
+#include <immintrin.h>
+#endif
+
+#include "ingest.h"
+
+/*
+The per-period ingest stage. Samples come out of the ALSA mmap area as S16 and
+go into the capture VRB as floats, or for the fixed-point path back out as
+int16; on the way, the DC offset is optionally removed and the energy of what
+was written is summed. It's all done in one pass so the period is only read
+once, and this runs all the time, whether or not a note is playing.
+*/
+
+// Fraction of the way the DC estimate moves towards each call's mean.
+#define DC_ALPHA 0.05f
+// Well under A0 (27.5 Hz), so the fundamental isn't touched.
+#define HIGHPASS_CUTOFF 10.f
+
+
+void ingest_init(
+    Ingest *ig, IngestFilter filter, VRBFormat format, unsigned rate
+)
+{
+    ig->filter = filter;
+    ig->format = format;
+    ig->mean = 0;
+    ig->r = expf(-2*M_PI*HIGHPASS_CUTOFF/rate);
+    ig->x1 = 0;
+    ig->y1 = 0;
+}
+
+
+// Round and saturate to what the fixed-point kernel can take.
+static inline int16_t to_s16(float x)
+{
+    if (x > INT16_MAX)
+        return INT16_MAX;
+    if (x < -INT16_MAX)
+        return -INT16_MAX;
+    return lrintf(x);
+}
+
+
+/*
+out = in - offset. Returns the sum of out squared, and sets *sum to the sum of
+in. convert_s16() is the same, but rounds out to int16; the energy is still of
+the unrounded values.
+*/
+#if defined(__ARM_NEON) && defined(__aarch64__)
+
+static float convert(
+    const sample_t *restrict in, float *restrict out, unsigned n,
+    float offset, float *sum
+)
+{
+    float32x4_t off = vdupq_n_f32(offset),
+                s0 = vdupq_n_f32(0), s1 = s0,
+                e0 = s0, e1 = s0;
+    unsigned i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        int16x8_t x = vld1q_s16(in + i);
+        float32x4_t lo = vcvtq_f32_s32(vmovl_s16(vget_low_s16(x))),
+                    hi = vcvtq_f32_s32(vmovl_s16(vget_high_s16(x)));
+        s0 = vaddq_f32(s0, lo);
+        s1 = vaddq_f32(s1, hi);
+        lo = vsubq_f32(lo, off);
+        hi = vsubq_f32(hi, off);
+        vst1q_f32(out + i, lo);
+        vst1q_f32(out + i + 4, hi);
+        e0 = vfmaq_f32(e0, lo, lo);
+        e1 = vfmaq_f32(e1, hi, hi);
+    }
+    float s = vaddvq_f32(vaddq_f32(s0, s1)),
+          e = vaddvq_f32(vaddq_f32(e0, e1));
+
+    for (; i < n; i++)
+    {
+        float x = in[i];
+        s += x;
+        x -= offset;
+        out[i] = x;
+        e += x*x;
+    }
+    *sum = s;
+    return e;
+}
+
+static float convert_s16(
+    const sample_t *restrict in, int16_t *restrict out, unsigned n,
+    float offset, float *sum
+)
+{
+    float32x4_t off = vdupq_n_f32(offset),
+                s0 = vdupq_n_f32(0), s1 = s0,
+                e0 = s0, e1 = s0;
+    int16x8_t lowest = vdupq_n_s16(-INT16_MAX);
+    unsigned i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        int16x8_t x = vld1q_s16(in + i);
+        float32x4_t lo = vcvtq_f32_s32(vmovl_s16(vget_low_s16(x))),
+                    hi = vcvtq_f32_s32(vmovl_s16(vget_high_s16(x)));
+        s0 = vaddq_f32(s0, lo);
+        s1 = vaddq_f32(s1, hi);
+        lo = vsubq_f32(lo, off);
+        hi = vsubq_f32(hi, off);
+        e0 = vfmaq_f32(e0, lo, lo);
+        e1 = vfmaq_f32(e1, hi, hi);
+        int16x8_t y = vcombine_s16(
+            vqmovn_s32(vcvtnq_s32_f32(lo)), vqmovn_s32(vcvtnq_s32_f32(hi))
+        );
+        vst1q_s16(out + i, vmaxq_s16(y, lowest));
+    }
+    float s = vaddvq_f32(vaddq_f32(s0, s1)),
+          e = vaddvq_f32(vaddq_f32(e0, e1));
+
+    for (; i < n; i++)
+    {
+        float x = in[i];
+        s += x;
+        x -= offset;
+        out[i] = to_s16(x);
+        e += x*x;
+    }
+    *sum = s;
+    return e;
+}
+
+#elif defined(__AVX2__) && defined(__FMA__)
+
+static float hsum(__m256 v)
+{
+    __m128 s = _mm_add_ps(
+        _mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1)
+    );
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_movehdup_ps(s));
+    return _mm_cvtss_f32(s);
+}
+
+static float convert(
+    const sample_t *restrict in, float *restrict out, unsigned n,
+    float offset, float *sum
+)
+{
+    __m256 off = _mm256_set1_ps(offset),
+           s0 = _mm256_setzero_ps(), e0 = s0;
+    unsigned i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256 x = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(
+            _mm_loadu_si128((const __m128i*)(in + i))
+        ));
+        s0 = _mm256_add_ps(s0, x);
+        x = _mm256_sub_ps(x, off);
+        _mm256_storeu_ps(out + i, x);
+        e0 = _mm256_fmadd_ps(x, x, e0);
+    }
+    float s = hsum(s0), e = hsum(e0);
+
+    for (; i < n; i++)
+    {
+        float x = in[i];
+        s += x;
+        x -= offset;
+        out[i] = x;
+        e += x*x;
+    }
+    *sum = s;
+    return e;
+}
+
+static float convert_s16(
+    const sample_t *restrict in, int16_t *restrict out, unsigned n,
+    float offset, float *sum
+)
+{
+    __m256 off = _mm256_set1_ps(offset),
+           s0 = _mm256_setzero_ps(), e0 = s0;
+    __m128i lowest = _mm_set1_epi16(-INT16_MAX);
+    unsigned i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256 x = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(
+            _mm_loadu_si128((const __m128i*)(in + i))
+        ));
+        s0 = _mm256_add_ps(s0, x);
+        x = _mm256_sub_ps(x, off);
+        e0 = _mm256_fmadd_ps(x, x, e0);
+        __m256i q = _mm256_cvtps_epi32(x);
+        __m128i y = _mm_packs_epi32(
+            _mm256_castsi256_si128(q), _mm256_extracti128_si256(q, 1)
+        );
+        _mm_storeu_si128((__m128i*)(out + i), _mm_max_epi16(y, lowest));
+    }
+    float s = hsum(s0), e = hsum(e0);
+
+    for (; i < n; i++)
+    {
+        float x = in[i];
+        s += x;
+        x -= offset;
+        out[i] = to_s16(x);
+        e += x*x;
+    }
+    *sum = s;
+    return e;
+}
+
+#else
+
+static float convert(
+    const sample_t *restrict in, float *restrict out, unsigned n,
+    float offset, float *sum
+)
+{
+    float s = 0, e = 0;
+    for (unsigned i = 0; i < n; i++)
+    {
+        float x = in[i];
+        s += x;
+        x -= offset;
+        out[i] = x;
+        e += x*x;
+    }
+    *sum = s;
+    return e;
+}
+
+static float convert_s16(
+    const sample_t *restrict in, int16_t *restrict out, unsigned n,
+    float offset, float *sum
+)
+{
+    float s = 0, e = 0;
+    for (unsigned i = 0; i < n; i++)
+    {
+        float x = in[i];
+        s += x;
+        x -= offset;
+        out[i] = to_s16(x);
+        e += x*x;
+    }
+    *sum = s;
+    return e;
+}
+
+#endif
+
+
+static float highpass(
+    Ingest *ig, const sample_t *restrict in, void *restrict out, unsigned n
+)
+{
+    bool s16 = ig->format == VRB_S16;
+    float r = ig->r, x1 = ig->x1, y1 = ig->y1, e = 0;
+    for (unsigned i = 0; i < n; i++)
+    {
+        float x = in[i],
+              y = x - x1 + r*y1;
+        x1 = x;
+        y1 = y;
+        if (s16)
+            ((int16_t*)out)[i] = to_s16(y);
+        else
+            ((float*)out)[i] = y;
+        e += y*y;
+    }
+    ig->x1 = x1;
+    ig->y1 = y1;
+    return e;
+}
+
+
+// Either convert() or convert_s16(), depending on the format.
+static float convert_to(
+    const Ingest *ig, const sample_t *restrict in, void *restrict out,
+    unsigned n, float offset, float *sum
+)
+{
+    if (ig->format == VRB_S16)
+        return convert_s16(in, out, n, offset, sum);
+    return convert(in, out, n, offset, sum);
+}
+
+
+/*
+Convert n samples from in to out, filtering as configured, and in the format
+configured. Returns the energy (sum of squares) of what was written to out, so
+that nobody has to read it back to find the power.
+*/
+float ingest(
+    Ingest *ig, const sample_t *restrict in, void *restrict out, unsigned n
+)
+{
+    float sum;
+    switch (ig->filter)
+    {
+        case INGEST_RAW:
+            return convert_to(ig, in, out, n, 0, &sum);
+
+        case INGEST_DC:
+        {
+            float e = convert_to(ig, in, out, n, ig->mean, &sum);
+            if (n)
+                ig->mean += DC_ALPHA*(sum/n - ig->mean);
+            return e;
+        }
+
+        case INGEST_HIGHPASS:
+            return highpass(ig, in, out, n);
+
+        default:
+            assert(false);
+    }
+}
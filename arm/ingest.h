@@ -0,0 +1,35 @@
+#pragma once
+
+#include "capture.h"
+#include "vrb.h"
+
+
+typedef enum
+{
+    // Convert only.
+    INGEST_RAW,
+    // Subtract a slowly-tracked estimate of the DC offset. Vectorised.
+    INGEST_DC,
+    // A one-pole DC-blocking high-pass. Recursive, so scalar.
+    INGEST_HIGHPASS
+} IngestFilter;
+
+
+typedef struct
+{
+    IngestFilter filter;
+    // What's written out: floats, or int16s saturated to +-INT16_MAX.
+    VRBFormat format;
+    // INGEST_DC: the running DC estimate.
+    float mean;
+    // INGEST_HIGHPASS: the pole, and the previous input and output.
+    float r, x1, y1;
+} Ingest;
+
+
+void ingest_init(
+    Ingest *ig, IngestFilter filter, VRBFormat format, unsigned rate
+);
+float ingest(
+    Ingest *ig, const sample_t *restrict in, void *restrict out, unsigned n
+);
@@ -3,66 +3,106 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
-#include <cblas.h>
 #include <string.h>
+#include <unistd.h>
+
+#include <sys/epoll.h>
 
 #include "util.h"
 #include "capture.h"
+#include "detect.h"
+#include "feed.h"
 #include "freq.h"
 #include "gauge.h"
+#include "prof.h"
+#include "reactor.h"
+#include "receiver.h"
+#include "rt.h"
 #include "vrb.h"
 
 
 #define ACLEN 2048
-#define POWER_THRESHOLD 64
+// How many periods analysis may fall behind capture before audio is lost.
+#define SLACK_PERIODS 4
 
 
 static CaptureContext *capture = NULL;
+static Feed *feed = NULL;
+static Detector *detector = NULL;
 static GaugeContext *gauge = NULL;
-
+static Reactor *reactor = NULL;
+static Receiver *receiver = NULL;
+// Whether this thread is in its analysis loop, as far as rt_report() goes
+static bool analysing = false;
 
 
 static void cleanup()
 {
     putchar('\n'); // after the \r from consume()
 
+    if (analysing)
+        rt_leave(RT_ANALYSIS);
+
+    // The capture thread has to go before the capture it's using.
+    if (feed)
+        feed_stop(&feed);
+
+    if (reactor)
+        reactor_destroy(&reactor);
+
     if (capture)
         capture_deinit(&capture);
 
     if (gauge)
         gauge_deinit(&gauge);
+
+    // Only once the gauge has closed its end, so that it's all been received
+    if (receiver)
+    {
+        receiver_stop(receiver);
+        ReceiverStats stats = receiver_stats(receiver);
+        printf(
+            "Receiver: %lu bytes, %lu loads, %lu bad checks, %lu strays\n",
+            stats.bytes, stats.updates, stats.bad_checks, stats.strays
+        );
+        receiver_destroy(&receiver);
+    }
+
+    if (detector)
+        detector_destroy(&detector);
+    autocorrelate_deinit();
+    prof_deinit();
+    rt_report();
 }
 
 
+// Only until the event loop takes SIGINT over.
 static void handle_sigint(int signal)
 {
     exit(0); // will call cleanup anyway
 }
 
 
-static void consume(CaptureContext *cc, const sample_t *restrict samples, void *p)
+/*
+Wait for the next N samples from the capture thread. Returns their power, which
+will always be needed. If analysis fell far enough behind that audio was lost,
+*lost is set, and the history is no longer continuous. At the end of a replay,
+this is where we exit.
+*/
+static float read_audio(Feed *feed, unsigned N, bool *lost)
 {
-    VRB *b = p;
-    float *restrict present = b->present;
-    unsigned N = capture_period(cc);
-    for (unsigned i = 0; i < N; i++)
-        present[i] = samples[i];
-    vrb_advance(b, N*sizeof(float));
-}
-// Returns the power of the last capture, which will always be needed.
-static float read_audio(CaptureContext *cc, VRB *b)
-{
-    capture_do_capture(cc, consume, b);
-
-    unsigned N = capture_period(cc);
-    float *last_cap = vrb_past(b, N*sizeof(float));
-    return cblas_sdot(
-        N,         // len
-        last_cap,  // x
-        1,         // incX
-        last_cap,  // y
-        1          // incY
-    )/N;
+    float power;
+    unsigned n_lost;
+    if (!feed_read(feed, N, &power, &n_lost))
+    {
+        puts("End of replay");
+        exit(0);
+    }
+    if (n_lost)
+        fprintf(stderr, "Analysis fell behind; lost %u samples\n", n_lost);
+    if (lost)
+        *lost = n_lost > 0;
+    return power;
 }
 
 static float power_to_db(float power)
@@ -70,6 +110,217 @@ static float power_to_db(float power)
     return clip((log10f(power) - 2)/5);
 }
 
+/*
+The gauges refresh on their own thread, from whatever was posted last, so this
+never waits on SPI. There's no gauge when replaying on a machine without one.
+*/
+static void show(float db, float octave, float semitone, float deviation)
+{
+    if (gauge)
+        gauge_post(gauge, db, octave, semitone, deviation);
+}
+
+// Run one period that has already been captured through the detector.
+static void analyse(unsigned period)
+{
+    bool lost;
+    float power = read_audio(feed, period, &lost), f;
+    PROF_BEGIN(PROF_FRAME);
+    bool note = detector_update(detector, feed_view(feed), power, lost, &f);
+
+    // Capture wrote over the history while the detector was reading it, so
+    // this reading is no good. The next read counts it as lost.
+    if (!feed_intact(feed))
+    {
+        PROF_END(PROF_FRAME);
+        return;
+    }
+
+    /*
+    If capture delivered several periods at once (or we fell behind), every
+    one of them has to go through the detector, but only the newest is worth
+    showing.
+    */
+    if (capture_realtime(capture) && feed_pending(feed) >= period)
+    {
+        PROF_END(PROF_FRAME);
+        return;
+    }
+
+    if (!note)
+    {
+        printf("%f %f\n", power, power_to_db(power));
+        show(power_to_db(power), 0, 0, 0);
+        PROF_END(PROF_FRAME);
+        return;
+    }
+
+    float octave = 0, semitone = 0, deviation = 0;
+    if (f > 0)
+    {
+        octave = log2f(f/C0);
+        semitone = mod1rd(octave + 1./24);
+        deviation = mod1rd(12*semitone);
+
+        octave = clip(octave/8);
+    }
+    printf(
+        "%f %f    %f %f %f %f",
+        power,
+        f,
+        power_to_db(power),
+        octave,
+        semitone,
+        deviation
+    );
+    // Reading partials, each one's cents from its harmonic of the key as well
+    const Partial *partials = detector_partials(detector);
+    if (partials)
+    {
+        printf("   ");
+        for (unsigned h = 0; h < SPECTRUM_HARMONICS; h++)
+            printf(" %.2f", partials[h].cents);
+    }
+    putchar('\n');
+    show(
+        power_to_db(power),
+        octave,
+        semitone,
+        deviation
+    );
+    PROF_END(PROF_FRAME);
+}
+
+
+/*
+The capture thread has delivered something. Analyse every whole period there
+is now, but no more, so that a fast replay can't keep the loop from ever
+getting to the other events.
+*/
+static bool on_audio(int fd, uint32_t events, void *arg)
+{
+    uint64_t count;
+    (void)!read(fd, &count, sizeof(count));
+
+    unsigned period = capture_period(capture),
+             n = feed_pending(feed) / period;
+    for (unsigned i = 0; i < n; i++)
+        analyse(period);
+
+    // Nothing more is coming at the end of a replay, so there won't be another
+    // event. Finish it off; read_audio() is what says so and exits.
+    if (feed_eof(feed))
+        while (true)
+            analyse(period);
+    return true;
+}
+
+
+static bool on_sigint(int fd, uint32_t events, void *arg)
+{
+    return false;
+}
+
+
+static void usage(const char *name)
+{
+    fprintf(
+        stderr,
+        "Usage: %s [--replay FILE [--fast] [--rate HZ]] [--gauge | --receiver]\n"
+        "          [--key N [--spectrum | --bank]] [--nsdf] [--onset]\n"
+        "          [--progressive] [--fixed]\n"
+        "          [--realtime [--cpus C,A,G] [--huge-pages]]\n"
+        "  --replay FILE  analyse a WAV or raw S16 mono recording\n"
+        "  --fast         replay it as fast as possible\n"
+        "  --rate HZ      sampling rate of a raw recording\n"
+        "  --gauge        drive the gauge even when replaying\n"
+        "  --receiver     drive a software stand-in for the gauge instead\n"
+        "  --key N        only listen for key N, 1 (A0) to 88 (C8)\n"
+        "  --spectrum     read the key from its partials' spectrum instead of\n"
+        "                 autocorrelating\n"
+        "  --bank         the same, from a sliding DFT of only the bins around\n"
+        "                 each partial\n"
+        "  --nsdf         read the autocorrelation as its NSDF, for a reading\n"
+        "                 sooner after each strike\n"
+        "  --onset        start analysing once each strike's attack settles,\n"
+        "                 rather than after a whole history length\n"
+        "  --progressive  show rough readings from the strike on, and narrow the\n"
+        "                 search down to the note once it's found\n"
+        "  --fixed        keep the history as int16, and autocorrelate in\n"
+        "                 fixed point\n"
+        "  --realtime     lock and prefault memory, and pin the threads to CPUs\n"
+        "                 at realtime priorities\n"
+        "  --cpus C,A,G   CPUs for capture, analysis and the gauge, or -1 for\n"
+        "                 any (default 3,2,1)\n"
+        "  --huge-pages   back the sample histories with huge pages\n",
+        name
+    );
+    exit(1);
+}
+
+static CaptureOptions parse_args(
+    int argc, const char **argv, bool *use_gauge, bool *use_receiver, int *key,
+    bool *spectrum, bool *bank, bool *nsdf, bool *onset, bool *progressive,
+    VRBFormat *format, bool *realtime, RTConfig *rt
+)
+{
+    CaptureOptions opts = {.replay = NULL, .fast = false, .raw_rate = 0};
+    bool force_gauge = false;
+    *use_receiver = false;
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--replay") && i + 1 < argc)
+            opts.replay = argv[++i];
+        else if (!strcmp(argv[i], "--fast"))
+            opts.fast = true;
+        else if (!strcmp(argv[i], "--rate") && i + 1 < argc)
+            opts.raw_rate = strtoul(argv[++i], NULL, 10);
+        else if (!strcmp(argv[i], "--gauge"))
+            force_gauge = true;
+        else if (!strcmp(argv[i], "--receiver"))
+            *use_receiver = true;
+        else if (!strcmp(argv[i], "--key") && i + 1 < argc)
+        {
+            *key = atoi(argv[++i]) - 1;
+            if (*key < 0 || *key >= N_NOTES)
+                usage(argv[0]);
+        }
+        else if (!strcmp(argv[i], "--spectrum"))
+            *spectrum = true;
+        else if (!strcmp(argv[i], "--bank"))
+            *bank = true;
+        else if (!strcmp(argv[i], "--nsdf"))
+            *nsdf = true;
+        else if (!strcmp(argv[i], "--onset"))
+            *onset = true;
+        else if (!strcmp(argv[i], "--progressive"))
+            *progressive = true;
+        else if (!strcmp(argv[i], "--fixed"))
+            *format = VRB_S16;
+        else if (!strcmp(argv[i], "--realtime"))
+            *realtime = true;
+        else if (!strcmp(argv[i], "--cpus") && i + 1 < argc)
+        {
+            int *cpus = rt->cpus;
+            if (sscanf(
+                argv[++i], "%d,%d,%d",
+                cpus + RT_CAPTURE, cpus + RT_ANALYSIS, cpus + RT_GAUGE
+            ) != 3)
+                usage(argv[0]);
+        }
+        else if (!strcmp(argv[i], "--huge-pages"))
+            rt->huge_pages = true;
+        else
+            usage(argv[0]);
+    }
+    if ((*spectrum || *bank) && (*key < 0 || *nsdf || (*spectrum && *bank)))
+        usage(argv[0]);
+    *use_gauge = !*use_receiver && (
+        force_gauge || !(opts.replay || getenv("PIANOTUNER_REPLAY"))
+    );
+    return opts;
+}
+
 int main(int argc, const char **argv)
 {
     if (atexit(cleanup))
@@ -79,92 +330,67 @@ int main(int argc, const char **argv)
     }
     signal(SIGINT, handle_sigint);
 
-    capture = capture_init();
+    prof_init();
+
+    bool use_gauge, use_receiver, spectrum = false, bank = false, nsdf = false,
+         onset = false, progressive = false, realtime = false;
+    int key = -1;
+    VRBFormat format = VRB_FLOAT;
+    RTConfig rt = rt_defaults();
+    CaptureOptions opts = parse_args(
+        argc, argv, &use_gauge, &use_receiver, &key, &spectrum, &bank, &nsdf,
+        &onset, &progressive, &format, &realtime, &rt
+    );
+    // Before anything's allocated, so that all of it is locked and prefaulted
+    if (realtime)
+        rt_start(&rt);
+
+    capture = capture_init(&opts);
     unsigned period = capture_period(capture);
-    gauge = gauge_init();
+    if (use_gauge)
+        gauge = gauge_init();
+    else if (use_receiver)
+    {
+        receiver = receiver_create(0);
+        gauge = gauge_init_stream(receiver_fd(receiver));
+    }
 
     //gauge_demo(gauge);
 
-    unsigned hist_len = ACLEN + period;
-    VRB *hist = vrb_create(hist_len*sizeof(float));
-    float ac[ACLEN];
+    detector = detector_create(
+        ACLEN, period, capture_rate(capture), format
+    );
+    // Wisdom shared with python/fft.py, which keeps it in the same place
+    if (spectrum)
+        detector_spectrum(detector, ".fftw_wisdom_float");
+    if (bank)
+        detector_bank(detector);
+    if (nsdf)
+        detector_nsdf(detector);
+    if (onset)
+        detector_onset(detector);
+    if (progressive)
+        detector_progressive(detector);
+    if (key >= 0)
+        detector_target(detector, key);
+    feed = feed_start(
+        capture, detector_history(detector), SLACK_PERIODS*period, INGEST_DC,
+        format
+    );
 
-    while (true)
-    {
-        float power;
-continue_outer_while:
-        power = read_audio(capture, hist);
-        printf("%f %f\n", power, power_to_db(power));
-        gauge_message(gauge, power_to_db(power), 0, 0, 0);
-        if (power > POWER_THRESHOLD)
-        {
-            /*
-            There is a note. Load the history buffer with mid-note audio data.
-            (The note start is overwritten because it contains transients that
-            mess with the reading.)
-            */
-            unsigned i = 0;
-            while (true)
-            {
-                power = read_audio(capture, hist);
-                i += period;
-                if (power < POWER_THRESHOLD)
-                {
-                    printf("%f %f\n", power, power_to_db(power));
-                    gauge_message(gauge, power_to_db(power), 0, 0, 0);
-                    goto continue_outer_while;
-                }
-                if (i >= hist_len)
-                    break;
-                printf("%f %f\n", power, power_to_db(power));
-                gauge_message(gauge, power_to_db(power), 0, 0, 0);
-            }
-
-            memset(ac, 0, sizeof(ac));
-            while (true)
-            {
-                autocorrelate(vrb_past(hist, hist_len*sizeof(float)), hist_len,
-                              ac, ACLEN);
-                float f = freq(ac, ACLEN, capture_rate(capture));
-                float octave = 0, semitone = 0, deviation = 0;
-                if (f > 0)
-                {
-                    octave = log2f(f/C0);
-                    semitone = mod1rd(octave + 1./24);
-                    deviation = mod1rd(12*semitone);
-
-                    octave = clip(octave/8);
-                }
-                printf(
-                    "%f %f    %f %f %f %f\n",
-                    power,
-                    f,
-                    power_to_db(power),
-                    octave,
-                    semitone,
-                    deviation
-                );
-                gauge_message(
-                    gauge,
-                    power_to_db(power),
-                    octave,
-                    semitone,
-                    deviation
-                );
-
-                power = read_audio(capture, hist);
-                if (power < POWER_THRESHOLD)
-                {
-                    printf("%f %f\n", power, power_to_db(power));
-                    gauge_message(gauge, power_to_db(power), 0, 0, 0);
-                    break;
-                }
-            }
-            //save(ac, sizeof(ac), "data/ac.bin");
-        }
-    }
+    /*
+    Everything from here on is driven by one event loop: audio from the
+    capture thread and SIGINT, each handled only when it's ready. The gauges
+    have a loop of their own.
+    */
+    reactor = reactor_create();
+    reactor_add(reactor, feed_fd(feed), EPOLLIN, on_audio, NULL);
+    reactor_signal(reactor, SIGINT, on_sigint, NULL);
 
+    rt_enter(RT_ANALYSIS);
+    analysing = true;
+    while (reactor_run(reactor, -1));
 
-    exit(1);
-    return 255;
+    exit(0);
+    return 0;
 }
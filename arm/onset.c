@@ -0,0 +1,91 @@
+#include <assert.h>
+#include <math.h>
+#include <stdint.h>
+
+#include "onset.h"
+
+/*
+The strike detector. Rather than sit out a fixed length after every strike,
+the detector watches the energy envelope, taken a millisecond at a time, and
+lets analysis start as soon as the attack has settled: once the envelope has
+stopped rising and the hammer's thump has died away, which is when its slope
+over the last few points (fewer, for the first few) is within
+SETTLE_DB_PER_POINT either way. A note's own decay is far gentler than that,
+even at the top of the keyboard.
+
+Since the hammer stays on the string for longer in the bass, the caller also
+gives a least time for the attack, from the start of the note.
+
+The envelope is one point per block, i.e. the stream decimated by the block
+length, so keeping it costs a multiply-add per sample and a log per block.
+*/
+
+// Length of an envelope point.
+#define BLOCK_SECONDS 1e-3
+// Points that the slope is taken over; less than ONSET_POINTS.
+#define SLOPE_POINTS 4
+#define SETTLE_DB_PER_POINT 0.3f
+
+
+void onset_init(Onset *o, unsigned rate)
+{
+    o->block = rate*BLOCK_SECONDS;
+    assert(o->block > 0);
+    onset_start(o, 0, 0);
+}
+
+
+/*
+Start looking for a new note: the first point with more than threshold mean
+power, and then for its attack to settle, which takes at least min_seconds.
+*/
+void onset_start(Onset *o, float min_seconds, float threshold)
+{
+    o->filled = 0;
+    o->energy = 0;
+    o->threshold = threshold;
+    o->points = 0;
+    o->min_points = ceilf(min_seconds / BLOCK_SECONDS);
+    o->settled = false;
+}
+
+
+// Take one finished point of the envelope.
+static void point(Onset *o)
+{
+    float power = o->energy / o->block;
+    o->filled = 0;
+    o->energy = 0;
+
+    if (!o->points && !(power > o->threshold))
+        return;
+    float db = 10*log10f(power + 1);
+    unsigned p = o->points++;
+    o->db[p % ONSET_POINTS] = db;
+
+    // Over fewer points at first, so that a short least time still counts
+    if (!p || o->points < o->min_points)
+        return;
+    unsigned span = p < SLOPE_POINTS ? p : SLOPE_POINTS;
+    float slope = (db - o->db[(p - span) % ONSET_POINTS]) / span;
+    if (fabsf(slope) < SETTLE_DB_PER_POINT)
+        o->settled = true;
+}
+
+
+/*
+Take the next n samples of the stream, in the given format. Returns whether the
+attack has settled, as of them or before.
+*/
+bool onset_update(Onset *o, const void *x, VRBFormat format, unsigned n)
+{
+    for (unsigned i = 0; i < n && !o->settled; i++)
+    {
+        float s = format == VRB_S16
+            ? ((const int16_t*)x)[i] : ((const float*)x)[i];
+        o->energy += s*s;
+        if (++o->filled == o->block)
+            point(o);
+    }
+    return o->settled;
+}
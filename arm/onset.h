@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "vrb.h"
+
+
+// Envelope points kept, enough to take the slope over.
+#define ONSET_POINTS 8
+
+
+/*
+Tracks the energy envelope of a strike, to say when its attack is over. See
+onset.c.
+*/
+typedef struct
+{
+    // Samples per envelope point, and how many of them and how much energy
+    // are in the point being summed.
+    unsigned block, filled;
+    double energy;
+    // Mean power a point needs to count as the start of the note.
+    float threshold;
+    // The last ONSET_POINTS points, in dB, by points % ONSET_POINTS.
+    float db[ONSET_POINTS];
+    // Points since the note started, or 0 before it has; the fewest that the
+    // attack may take.
+    unsigned points, min_points;
+    bool settled;
+} Onset;
+
+
+void onset_init(Onset *o, unsigned rate);
+void onset_start(Onset *o, float min_seconds, float threshold);
+bool onset_update(Onset *o, const void *x, VRBFormat format, unsigned n);
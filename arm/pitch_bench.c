@@ -0,0 +1,370 @@
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "capture.h"
+#include "detect.h"
+#include "freq.h"
+#include "ingest.h"
+#include "util.h"
+#include "vrb.h"
+
+/*
+Run synthetic notes for all 88 keys, FMIN to FMAX, through the same ingest and
+detection path that main() runs on the capture feed, and report how fast and
+how accurate it is.
+
+The notes are meant to be hard in the ways a real piano is hard:
+- partials are stretched by string inharmonicity, more so up the keyboard;
+- bass fundamentals are weak next to their harmonics;
+- everything decays, higher partials and higher keys faster;
+- the strike is a burst of noise; and
+- there's a noise floor throughout.
+
+A reading is "valid" once it's within VALID_CENTS of the first partial. The
+time to the first one, and to the first reading of any kind, is counted in
+audio from the strike, since that's what someone at the piano waits for.
+Per-frame times are wall-clock, over ingest and detection of one period.
+
+With -k, the detector is told which key is coming, as with the tuner's --key,
+so only the lags around it are computed. With -f, the history is int16 and the
+autocorrelation fixed point, as with the tuner's --fixed; -e then makes no
+difference. With -s, the spectral engine reads the key's partials instead of
+autocorrelating, as with the tuner's --spectrum; that implies -k. -b is the
+same, but with the sliding DFT bank, as with the tuner's --bank. With -n, the
+lags are read as the NSDF, as with the tuner's --nsdf, which should bring the
+time to first valid down. With -o, the attack is gated by its envelope rather
+than sat out for the whole history length, as with the tuner's --onset. With
+-r, estimates are progressive, as with the tuner's --progressive: rough from
+the strike, then narrowing down to the lags around the note.
+
+Usage: pitch_bench [-a aclen] [-p period] [-e engine] [-t threads] [-k] [-f]
+                   [-s | -b | -n] [-o] [-r] [-v]
+*/
+
+#define RATE 48000
+#define LEAD_IN 0.25
+#define NOTE_LENGTH 2.0
+#define N_PARTIALS 16
+#define AMPLITUDE 12000
+#define NOISE 6
+#define VALID_CENTS 10
+
+
+typedef struct
+{
+    unsigned key;
+    unsigned readings, valid;
+    // Audio time from the strike to the first reading, and to the first valid
+    // one; negative if never.
+    double first_reading, first_valid;
+    float median_cents, worst_cents;
+} KeyResult;
+
+
+static float uniform(void)
+{
+    return (float)random()/RAND_MAX - 0.5f;
+}
+
+
+/*
+Render one key's strike, preceded by LEAD_IN of the noise floor alone. The
+first partial is exactly freq_of_key(); higher partials n are at
+n*f0*sqrt(1 + B*n^2), with f0 chosen to make that so.
+*/
+static unsigned make_note(unsigned key, sample_t *out)
+{
+    double f1 = freq_of_key(key),
+           // Roughly 5e-5 in the bass to 5e-3 at the top.
+           B = 5e-5 * pow(10, key/44.),
+           f0 = f1 / sqrt(1 + B),
+           tau = 4 * pow(FMIN/f1, 0.4);
+    unsigned lead = LEAD_IN*RATE, n = lead + NOTE_LENGTH*RATE;
+
+    double freqs[N_PARTIALS], amps[N_PARTIALS], decays[N_PARTIALS];
+    unsigned np = 0;
+    for (unsigned p = 1; p <= N_PARTIALS; p++)
+    {
+        double fp = p*f0*sqrt(1 + B*p*p);
+        if (fp > 0.45*RATE)
+            break;
+        freqs[np] = 2*M_PI*fp/RATE;
+        amps[np] = 1./p;
+        decays[np] = exp(-1/(tau/sqrt(p)*RATE));
+        np++;
+    }
+    // Below 100 Hz or so, the soundboard barely radiates the fundamental.
+    if (f1 < 100)
+        amps[0] *= f1/100;
+
+    double norm = 0;
+    for (unsigned p = 0; p < np; p++)
+        norm += amps[p];
+
+    for (unsigned i = 0; i < n; i++)
+    {
+        double x = NOISE*uniform();
+        if (i >= lead)
+        {
+            unsigned t = i - lead;
+            double note = 0;
+            for (unsigned p = 0; p < np; p++)
+            {
+                note += amps[p]*sin(freqs[p]*t);
+                amps[p] *= decays[p];
+            }
+            x += AMPLITUDE*note/norm;
+            // The hammer: about 5 ms of thump.
+            x += 0.2*AMPLITUDE*exp(-(double)t/(5e-3*RATE))*uniform();
+        }
+        if (x > INT16_MAX)
+            x = INT16_MAX;
+        if (x < INT16_MIN)
+            x = INT16_MIN;
+        out[i] = lrint(x);
+    }
+    return n;
+}
+
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+
+static int compare_floats(const void *a, const void *b)
+{
+    float x = *(const float*)a, y = *(const float*)b;
+    return (x > y) - (x < y);
+}
+
+
+static double percentile(const double *sorted, size_t n, double p)
+{
+    return sorted[(size_t)(p*(n - 1) + 0.5)];
+}
+
+
+int main(int argc, char **argv)
+{
+    unsigned aclen = 2048, period = 1024, threads = 0;
+    const char *engine = NULL;
+    bool verbose = false, targeted = false, spectral = false, bank = false,
+         nsdf = false, gated = false, progressive = false;
+    VRBFormat format = VRB_FLOAT;
+    int opt;
+    while ((opt = getopt(argc, argv, "a:p:e:t:kfsbnorv")) != -1)
+    {
+        switch (opt)
+        {
+            case 'a': aclen = strtoul(optarg, NULL, 10); break;
+            case 'p': period = strtoul(optarg, NULL, 10); break;
+            case 'e': engine = optarg; break;
+            case 't': threads = strtoul(optarg, NULL, 10); break;
+            case 'k': targeted = true; break;
+            case 'f': format = VRB_S16; break;
+            case 's': spectral = targeted = true; break;
+            case 'b': spectral = bank = targeted = true; break;
+            case 'n': nsdf = true; break;
+            case 'o': gated = true; break;
+            case 'r': progressive = true; break;
+            case 'v': verbose = true; break;
+            default:
+                fprintf(
+                    stderr,
+                    "Usage: %s [-a aclen] [-p period] [-e engine] "
+                    "[-t threads] [-k] [-f] [-s | -b | -n] [-o] [-r] [-v]\n",
+                    argv[0]
+                );
+                return 1;
+        }
+    }
+    assert(aclen > 0 && period > 0);
+    if (spectral && nsdf)
+    {
+        fprintf(stderr, "The spectral engine has no NSDF\n");
+        return 1;
+    }
+    if (engine && !autocorrelate_select(engine))
+    {
+        fprintf(stderr, "No autocorrelation engine called %s\n", engine);
+        return 1;
+    }
+    if (!strcmp(autocorrelate_engine(), "parallel"))
+        autocorrelate_threads(threads);
+
+    printf(
+        "aclen %u, period %u, engine %s, %u Hz%s%s%s%s\n\n",
+        aclen, period,
+        bank ? "bank" : spectral ? "spectrum"
+            : format == VRB_S16 ? "fixed" : autocorrelate_engine(),
+        RATE,
+        targeted ? ", targeted" : "", nsdf ? ", NSDF" : "",
+        gated ? ", onset gate" : "", progressive ? ", progressive" : ""
+    );
+
+    unsigned max_samples = (LEAD_IN + NOTE_LENGTH)*RATE,
+             max_frames = max_samples/period;
+    sample_t *note = malloc(max_samples*sizeof(sample_t));
+    double *times = malloc(N_NOTES*max_frames*sizeof(double));
+    float *cents = malloc(max_frames*sizeof(float));
+    KeyResult results[N_NOTES];
+    assert(note && times && cents);
+    size_t n_times = 0;
+    double total_time = 0;
+
+    srandom(1);
+    for (unsigned key = 0; key < N_NOTES; key++)
+    {
+        unsigned n = make_note(key, note);
+        double f1 = freq_of_key(key);
+
+        // Fresh state for every key, as if the tuner had been quiet for ages.
+        Detector *d = detector_create(aclen, period, RATE, format);
+        if (bank)
+            detector_bank(d);
+        else if (spectral)
+            detector_spectrum(d, NULL);
+        if (nsdf)
+            detector_nsdf(d);
+        if (gated)
+            detector_onset(d);
+        if (progressive)
+            detector_progressive(d);
+        if (targeted)
+            detector_target(d, key);
+        size_t size = vrb_format_size(format);
+        VRB *hist = vrb_create((detector_history(d) + period)*size);
+        Ingest ig;
+        ingest_init(&ig, INGEST_DC, format, RATE);
+
+        KeyResult *r = results + key;
+        r->key = key;
+        r->readings = 0;
+        r->valid = 0;
+        r->first_reading = -1;
+        r->first_valid = -1;
+        r->worst_cents = 0;
+
+        for (unsigned i = 0; i + period <= n; i += period)
+        {
+            double start = monotonic();
+            float energy = ingest(&ig, note + i, hist->present, period);
+            vrb_advance(hist, period*size);
+            float f;
+            bool reading = detector_update(d, hist, energy/period, false, &f);
+            double t = monotonic() - start;
+            times[n_times++] = t;
+            total_time += t;
+
+            if (!reading)
+                continue;
+            double since = (i + period - LEAD_IN*RATE) / RATE;
+            if (r->first_reading < 0)
+                r->first_reading = since;
+            float c = f > 0 ? 1200*log2(f/f1) : INFINITY;
+            cents[r->readings++] = c;
+            if (fabsf(c) <= VALID_CENTS)
+            {
+                r->valid++;
+                if (r->first_valid < 0)
+                    r->first_valid = since;
+            }
+            if (fabsf(c) > fabsf(r->worst_cents))
+                r->worst_cents = c;
+        }
+
+        if (r->readings)
+        {
+            qsort(cents, r->readings, sizeof(float), compare_floats);
+            r->median_cents = cents[r->readings/2];
+        }
+        else
+            r->median_cents = NAN;
+
+        vrb_destroy(hist);
+        detector_destroy(&d);
+    }
+
+    if (verbose)
+    {
+        printf(
+            "%4s %9s %8s %8s %10s %10s %10s\n",
+            "key", "freq (Hz)", "readings", "valid", "first (ms)",
+            "median (c)", "worst (c)"
+        );
+        for (unsigned key = 0; key < N_NOTES; key++)
+        {
+            const KeyResult *r = results + key;
+            printf(
+                "%4u %9.2f %8u %8u %10.0f %10.2f %10.1f\n",
+                key + 1, freq_of_key(key), r->readings, r->valid,
+                r->first_valid*1e3, r->median_cents, r->worst_cents
+            );
+        }
+        putchar('\n');
+    }
+
+    // Accuracy summary: median error per key, and how long the wait was.
+    unsigned never = 0;
+    float worst_median = 0;
+    double first[N_NOTES], any[N_NOTES];
+    unsigned n_first = 0, n_any = 0;
+    for (unsigned key = 0; key < N_NOTES; key++)
+    {
+        const KeyResult *r = results + key;
+        if (r->first_reading >= 0)
+            any[n_any++] = r->first_reading;
+        if (r->first_valid < 0)
+        {
+            never++;
+            continue;
+        }
+        first[n_first++] = r->first_valid;
+        if (fabsf(r->median_cents) > fabsf(worst_median))
+            worst_median = r->median_cents;
+    }
+    qsort(first, n_first, sizeof(double), compare_doubles);
+    qsort(any, n_any, sizeof(double), compare_doubles);
+    qsort(times, n_times, sizeof(double), compare_doubles);
+
+    printf("Keys never valid (±%d c):  %u of %u\n", VALID_CENTS, never, N_NOTES);
+    printf("Worst median error:        %.2f c\n", worst_median);
+    if (n_any)
+        printf(
+            "Strike to reading (ms):   p50 %.0f  p90 %.0f  max %.0f\n",
+            percentile(any, n_any, 0.5)*1e3,
+            percentile(any, n_any, 0.9)*1e3,
+            any[n_any - 1]*1e3
+        );
+    if (n_first)
+        printf(
+            "Time to first valid (ms): p50 %.0f  p90 %.0f  max %.0f\n",
+            percentile(first, n_first, 0.5)*1e3,
+            percentile(first, n_first, 0.9)*1e3,
+            first[n_first - 1]*1e3
+        );
+    printf(
+        "Frame latency (us):       p50 %.1f  p90 %.1f  p99 %.1f  max %.1f\n",
+        percentile(times, n_times, 0.5)*1e6,
+        percentile(times, n_times, 0.9)*1e6,
+        percentile(times, n_times, 0.99)*1e6,
+        times[n_times - 1]*1e6
+    );
+    printf(
+        "Throughput:               %.0f frames/s (%.0fx real time)\n",
+        n_times/total_time, n_times*period/total_time/RATE
+    );
+
+    free(note);
+    free(times);
+    free(cents);
+    autocorrelate_deinit();
+    return never > 0;
+}
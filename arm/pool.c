@@ -0,0 +1,239 @@
+#include <assert.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "pool.h"
+#include "util.h"
+
+/*
+A persistent pool of worker threads for splitting up per-frame work. Threads
+are created and pinned once; after that, every pool_run() costs one futex wake
+to start the workers and, at worst, one futex wait for the last of them to
+finish. Waiting spins for a little while first, because at our frame sizes the
+work is often done before a sleep/wake round trip would be.
+*/
+
+#define SPINS 2000
+
+
+// The CPUs that workers are spread over, and their SCHED_FIFO priority (0 for
+// SCHED_OTHER), if they've been given.
+static cpu_set_t cpus;
+static int priority;
+static bool cpus_given = false;
+
+
+struct PoolTag
+{
+    unsigned n;  // threads, including the caller
+    pthread_t *threads;
+
+    PoolTask task;
+    void *arg;
+    bool stop;
+
+    // Bumped once per pool_run() to release the workers.
+    _Atomic uint32_t generation;
+    // Workers that haven't finished the current task yet.
+    _Atomic uint32_t pending;
+};
+
+
+typedef struct
+{
+    Pool *pool;
+    unsigned index;
+} WorkerArg;
+
+
+// Wait until *addr != val, spinning briefly before sleeping.
+static uint32_t wait_change(_Atomic uint32_t *addr, uint32_t val)
+{
+    uint32_t now;
+    for (unsigned i = 0; i < SPINS; i++)
+    {
+        now = atomic_load_explicit(addr, memory_order_acquire);
+        if (now != val)
+            return now;
+    }
+    while ((now = atomic_load_explicit(addr, memory_order_acquire)) == val)
+        futex_wait(addr, val);
+    return now;
+}
+
+
+static void *worker(void *p)
+{
+    WorkerArg arg = *(WorkerArg*)p;
+    free(p);
+    Pool *pool = arg.pool;
+
+    uint32_t seen = 0;
+    while (true)
+    {
+        seen = wait_change(&pool->generation, seen);
+        if (pool->stop)
+            break;
+
+        pool->task(pool->arg, arg.index, pool->n);
+
+        if (atomic_fetch_sub_explicit(
+            &pool->pending, 1, memory_order_acq_rel
+        ) == 1)
+            futex_wake(&pool->pending, 1);
+    }
+    return NULL;
+}
+
+
+static void pin(pthread_t thread, unsigned cpu)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    int err = pthread_setaffinity_np(thread, sizeof(set), &set);
+    if (err)
+        fprintf(stderr, "Failed to pin worker to CPU %u: %d\n", cpu, err);
+}
+
+
+static void schedule(pthread_t thread)
+{
+    struct sched_param param = {.sched_priority = priority};
+    int err = pthread_setschedparam(
+        thread, priority > 0 ? SCHED_FIFO : SCHED_OTHER, &param
+    );
+    if (err)
+        fprintf(stderr, "Failed to set worker priority: %d\n", err);
+}
+
+
+/*
+Spread the workers of every pool made from now on over the given CPUs, rather
+than one per CPU from CPU 1, at the given SCHED_FIFO priority, or SCHED_OTHER
+if it's 0. In realtime mode, that keeps them off the CPUs that other threads
+are pinned to, and below the kernel's interrupt threads. With no CPUs given,
+pool_default_size() is 1: there are none to spread over.
+*/
+void pool_cpus(const cpu_set_t *c, int p)
+{
+    cpus = *c;
+    priority = p;
+    cpus_given = true;
+}
+
+
+/*
+How many threads a pool should have for one per CPU: the caller, and a worker
+on each CPU that pool_cpus() gave, or on every other online CPU if it hasn't
+been called.
+*/
+unsigned pool_default_size(void)
+{
+    if (cpus_given)
+        return CPU_COUNT(&cpus) + 1;
+    return sysconf(_SC_NPROCESSORS_ONLN);
+}
+
+
+// Which CPU worker i goes on: the ith of those given, round and round.
+static unsigned worker_cpu(unsigned i, unsigned n_cpus)
+{
+    if (!cpus_given || !CPU_COUNT(&cpus))
+        return i % n_cpus;
+    unsigned skip = (i - 1) % CPU_COUNT(&cpus);
+    for (unsigned cpu = 0; ; cpu++)
+        if (CPU_ISSET(cpu, &cpus) && !skip--)
+            return cpu;
+}
+
+
+/*
+Make a pool of n_threads threads, counting the caller of pool_run() as one of
+them. Worker i is pinned to CPU i, leaving CPU 0 for whoever calls pool_run(),
+unless pool_cpus() has said otherwise. Workers take the scheduling policy of
+the thread that makes the pool, again unless pool_cpus() has said otherwise.
+*/
+Pool *pool_create(unsigned n_threads)
+{
+    assert(n_threads > 0);
+
+    Pool *pool = malloc(sizeof(Pool));
+    assert(pool);
+
+    pool->n = n_threads;
+    pool->stop = false;
+    pool->task = NULL;
+    pool->arg = NULL;
+    atomic_init(&pool->generation, 0);
+    atomic_init(&pool->pending, 0);
+
+    pool->threads = malloc(n_threads*sizeof(pthread_t));
+    assert(pool->threads);
+
+    unsigned n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    for (unsigned i = 1; i < n_threads; i++)
+    {
+        WorkerArg *arg = malloc(sizeof(WorkerArg));
+        assert(arg);
+        arg->pool = pool;
+        arg->index = i;
+        assert(pthread_create(&pool->threads[i], NULL, worker, arg) == 0);
+        pin(pool->threads[i], worker_cpu(i, n_cpus));
+        if (cpus_given)
+            schedule(pool->threads[i]);
+    }
+
+    return pool;
+}
+
+
+void pool_destroy(Pool **pool)
+{
+    Pool *p = *pool;
+    p->stop = true;
+    atomic_fetch_add_explicit(&p->generation, 1, memory_order_release);
+    futex_wake(&p->generation, INT_MAX);
+
+    for (unsigned i = 1; i < p->n; i++)
+        assert(pthread_join(p->threads[i], NULL) == 0);
+
+    free(p->threads);
+    free(p);
+    *pool = NULL;
+}
+
+
+/*
+Run task on every thread in the pool, including this one as index 0, and
+return once they've all finished. Not reentrant: only one thread may call this
+at a time.
+*/
+void pool_run(Pool *pool, PoolTask task, void *arg)
+{
+    pool->task = task;
+    pool->arg = arg;
+    atomic_store_explicit(&pool->pending, pool->n - 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&pool->generation, 1, memory_order_release);
+    if (pool->n > 1)
+        futex_wake(&pool->generation, INT_MAX);
+
+    task(arg, 0, pool->n);
+
+    uint32_t pending;
+    while ((pending = atomic_load_explicit(
+        &pool->pending, memory_order_acquire
+    )) != 0)
+        wait_change(&pool->pending, pending);
+}
+
+
+unsigned pool_size(const Pool *pool)
+{
+    return pool->n;
+}
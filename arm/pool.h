@@ -0,0 +1,21 @@
+#pragma once
+
+#include <sched.h>
+
+
+struct PoolTag;
+typedef struct PoolTag Pool;
+
+
+// A task is run once on every thread in the pool per pool_run(), with index in
+// [0, count). Index 0 is always the calling thread.
+typedef void (*PoolTask)(void *arg, unsigned index, unsigned count);
+
+
+void pool_cpus(const cpu_set_t *cpus, int priority);
+unsigned pool_default_size(void);
+Pool *pool_create(unsigned n_threads);
+void pool_destroy(Pool **pool);
+
+void pool_run(Pool *pool, PoolTask task, void *arg);
+unsigned pool_size(const Pool *pool);
@@ -0,0 +1,107 @@
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "prof.h"
+#include "util.h"
+
+
+#ifdef PROFILE
+ProfShared *prof_shared = NULL;
+#endif
+
+
+const char *prof_stage_name(ProfStage stage)
+{
+    static const char *names[] =
+    {
+        "capture wait",
+        "ingest",
+        "read wait",
+        "autocorrelate",
+        "freq",
+        "gauge",
+        "frame",
+    };
+    assert(stage < SALEN(names));
+    return names[stage];
+}
+
+
+/*
+Create the shared memory segment, zeroed. If the build doesn't have PROFILE,
+there's nothing to publish and this does nothing.
+*/
+void prof_init(void)
+{
+#ifdef PROFILE
+    int fd = shm_open(PROF_SHM_NAME, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    if (fd == -1)
+    {
+        perror("Failed to create " PROF_SHM_NAME "; not profiling");
+        return;
+    }
+    assert(ftruncate(fd, sizeof(ProfShared)) == 0);
+    ProfShared *p = mmap(
+        NULL, sizeof(ProfShared), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0
+    );
+    assert(p != MAP_FAILED);
+    assert(close(fd) == 0);
+
+    memset(p, 0, sizeof(ProfShared));
+    p->n_stages = N_PROF_STAGES;
+#if defined(__aarch64__)
+    uint64_t hz;
+    __asm__ volatile("mrs %0, cntfrq_el0" : "=r"(hz));
+    p->tick_hz = hz;
+#else
+    p->tick_hz = 1000000000;
+#endif
+    // Last, so that prof_top never sees a half-made header.
+    atomic_thread_fence(memory_order_release);
+    p->magic = PROF_MAGIC;
+
+    prof_shared = p;
+#endif
+}
+
+
+void prof_deinit(void)
+{
+#ifdef PROFILE
+    if (!prof_shared)
+        return;
+    assert(munmap(prof_shared, sizeof(ProfShared)) == 0);
+    prof_shared = NULL;
+    shm_unlink(PROF_SHM_NAME);
+#endif
+}
+
+
+/*
+Map a running tuner's counters read-only. Returns null if there isn't one, or
+it wasn't built with PROFILE, or it was built with different stages.
+*/
+const ProfShared *prof_attach(void)
+{
+    int fd = shm_open(PROF_SHM_NAME, O_RDONLY, 0);
+    if (fd == -1)
+        return NULL;
+    const ProfShared *p = mmap(
+        NULL, sizeof(ProfShared), PROT_READ, MAP_SHARED, fd, 0
+    );
+    assert(close(fd) == 0);
+    if (p == MAP_FAILED)
+        return NULL;
+
+    if (p->magic != PROF_MAGIC || p->n_stages != N_PROF_STAGES)
+    {
+        munmap((void*)p, sizeof(ProfShared));
+        return NULL;
+    }
+    atomic_thread_fence(memory_order_acquire);
+    return p;
+}
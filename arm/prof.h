@@ -0,0 +1,123 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <time.h>
+
+/*
+Hot-path stage timing. Build with PROFILE=1 to turn it on; otherwise
+PROF_BEGIN() and PROF_END() are nothing at all. Times go into log2 histograms
+in a shared memory segment, for prof_top to show while the tuner runs.
+
+Usage, where stage is one of the ProfStage names:
+    PROF_BEGIN(PROF_FREQ);
+    f = freq(...);
+    PROF_END(PROF_FREQ);
+*/
+
+#define PROF_SHM_NAME "/pianotuner-prof"
+#define PROF_MAGIC 0x666f7270  // "prof"
+#define PROF_BUCKETS 48
+
+
+typedef enum
+{
+    // Capture thread
+    PROF_CAPTURE_WAIT,
+    PROF_INGEST,
+    // Analysis thread
+    PROF_READ_WAIT,
+    PROF_AUTOCORRELATE,
+    PROF_FREQ,
+    PROF_GAUGE,
+    PROF_FRAME,
+    N_PROF_STAGES
+} ProfStage;
+
+
+/*
+Each stage is only ever recorded from one thread, so its counters are updated
+with plain relaxed loads and stores rather than read-modify-writes. A reader
+may see a histogram that's one sample out from its count; that's fine.
+*/
+typedef struct
+{
+    _Atomic uint64_t count, total, max;
+    // buckets[b] counts times of [2^(b-1), 2^b) ticks; buckets[0] is 0 ticks.
+    _Atomic uint64_t buckets[PROF_BUCKETS];
+} ProfStats;
+
+
+typedef struct
+{
+    uint32_t magic, n_stages;
+    uint64_t tick_hz;
+    ProfStats stages[N_PROF_STAGES];
+} ProfShared;
+
+
+const char *prof_stage_name(ProfStage stage);
+void prof_init(void);
+void prof_deinit(void);
+const ProfShared *prof_attach(void);
+
+
+#ifdef PROFILE
+
+extern ProfShared *prof_shared;
+
+static inline uint64_t prof_ticks(void)
+{
+#if defined(__aarch64__)
+    // The generic timer's virtual count: a few cycles, no syscall.
+    uint64_t t;
+    __asm__ volatile("mrs %0, cntvct_el0" : "=r"(t));
+    return t;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1000000000ull + ts.tv_nsec;
+#endif
+}
+
+
+static inline void prof_bump(_Atomic uint64_t *x, uint64_t n)
+{
+    atomic_store_explicit(
+        x, atomic_load_explicit(x, memory_order_relaxed) + n,
+        memory_order_relaxed
+    );
+}
+
+
+static inline void prof_record(ProfStage stage, uint64_t ticks)
+{
+    if (!prof_shared)
+        return;
+    ProfStats *s = prof_shared->stages + stage;
+
+    unsigned b = ticks ? 64 - __builtin_clzll(ticks) : 0;
+    if (b >= PROF_BUCKETS)
+        b = PROF_BUCKETS - 1;
+
+    prof_bump(s->buckets + b, 1);
+    prof_bump(&s->total, ticks);
+    if (ticks > atomic_load_explicit(&s->max, memory_order_relaxed))
+        atomic_store_explicit(&s->max, ticks, memory_order_relaxed);
+    // Last, so that a reader that sees the count sees the rest.
+    atomic_store_explicit(
+        &s->count, atomic_load_explicit(&s->count, memory_order_relaxed) + 1,
+        memory_order_release
+    );
+}
+
+#define PROF_BEGIN(stage) uint64_t prof_begin_##stage = prof_ticks()
+#define PROF_END(stage) \
+    prof_record(stage, prof_ticks() - prof_begin_##stage)
+
+#else
+
+#define PROF_BEGIN(stage)
+#define PROF_END(stage)
+
+#endif
@@ -0,0 +1,122 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "prof.h"
+
+/*
+Show the tuner's stage timings live, as published by a PROFILE=1 build. Each
+refresh shows what happened since the last one, so the percentiles are over a
+rolling window of one interval. Percentiles come from the log2 histograms, so
+they're only estimates within a factor of two; max is exact, but all-time.
+
+Usage: prof_top [interval in seconds, default 1]
+*/
+
+
+static void snapshot(const ProfShared *p, ProfStats *out)
+{
+    for (unsigned s = 0; s < N_PROF_STAGES; s++)
+    {
+        const ProfStats *in = p->stages + s;
+        ProfStats *o = out + s;
+        atomic_store(
+            &o->count,
+            atomic_load_explicit(&in->count, memory_order_acquire)
+        );
+        atomic_store(&o->total, atomic_load(&in->total));
+        atomic_store(&o->max, atomic_load(&in->max));
+        for (unsigned b = 0; b < PROF_BUCKETS; b++)
+            atomic_store(&o->buckets[b], atomic_load(&in->buckets[b]));
+    }
+}
+
+
+/*
+The time that the given fraction of the counts fall below, interpolating
+linearly within its bucket, and never more than the worst seen.
+*/
+static double percentile(
+    const uint64_t *buckets, uint64_t count, uint64_t max, double p
+)
+{
+    if (!count)
+        return 0;
+    double want = p*count;
+    uint64_t seen = 0;
+    for (unsigned b = 0; b < PROF_BUCKETS; b++)
+    {
+        if (seen + buckets[b] > want)
+        {
+            if (b == 0)
+                return 0;
+            double lo = 1ull << (b - 1), hi = 1ull << b,
+                   t = lo + (hi - lo)*(want - seen)/buckets[b];
+            return t < max ? t : max;
+        }
+        seen += buckets[b];
+    }
+    return max;
+}
+
+
+int main(int argc, const char **argv)
+{
+    double interval = 1;
+    if (argc > 1)
+        assert(sscanf(argv[1], "%lf", &interval) == 1 && interval > 0);
+
+    const ProfShared *p = prof_attach();
+    if (!p)
+    {
+        fputs(
+            "No counters at " PROF_SHM_NAME "; is pianotuner running, and "
+            "was it built with PROFILE=1?\n",
+            stderr
+        );
+        return 1;
+    }
+    double us = 1e6 / p->tick_hz;
+
+    static ProfStats prev[N_PROF_STAGES], now[N_PROF_STAGES];
+    snapshot(p, prev);
+
+    while (true)
+    {
+        usleep(interval*1e6);
+        snapshot(p, now);
+
+        // Home and clear
+        fputs("\033[H\033[2J", stdout);
+        printf(
+            "%-14s %9s %9s %9s %9s %9s %10s\n",
+            "stage", "calls/s", "mean us", "p50 us", "p99 us", "max us",
+            "total"
+        );
+        for (unsigned s = 0; s < N_PROF_STAGES; s++)
+        {
+            uint64_t count = now[s].count - prev[s].count,
+                     total = now[s].total - prev[s].total,
+                     buckets[PROF_BUCKETS];
+            for (unsigned b = 0; b < PROF_BUCKETS; b++)
+                buckets[b] = now[s].buckets[b] - prev[s].buckets[b];
+
+            printf(
+                "%-14s %9.1f %9.1f %9.1f %9.1f %9.1f %10llu\n",
+                prof_stage_name(s),
+                count / interval,
+                count ? total*us/count : 0,
+                percentile(buckets, count, now[s].max, 0.5)*us,
+                percentile(buckets, count, now[s].max, 0.99)*us,
+                now[s].max*us,
+                (unsigned long long)now[s].count
+            );
+        }
+        fflush(stdout);
+        memcpy(prev, now, sizeof(now));
+    }
+    return 0;
+}
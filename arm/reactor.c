@@ -0,0 +1,207 @@
+#include <assert.h>
+#include <errno.h>
+#include <math.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+
+#include "reactor.h"
+
+/*
+A minimal epoll event loop. Everything a thread waits on goes in one reactor,
+and each reactor_run() sleeps until at least one of them is ready, then
+dispatches only those. Nothing is ever polled and nothing sleeps blind: a
+timeout, if there is one, is only a backstop.
+
+Timers and signals are file descriptors too (timerfd and signalfd). For those,
+the reactor reads the expiry count or signal info itself, so that their
+handlers don't have to, and so that they can't be left readable by mistake.
+*/
+
+#define MAX_SOURCES 8
+// Events dispatched per epoll_wait(); more just wait for the next call.
+#define MAX_EVENTS MAX_SOURCES
+
+
+typedef enum
+{
+    SOURCE_FD,
+    SOURCE_TIMER,
+    SOURCE_SIGNAL
+} SourceKind;
+
+
+typedef struct
+{
+    int fd;
+    SourceKind kind;
+    ReactorHandler handler;
+    void *arg;
+} Source;
+
+
+struct ReactorTag
+{
+    int epoll;
+    Source sources[MAX_SOURCES];
+    unsigned n_sources;
+};
+
+
+Reactor *reactor_create(void)
+{
+    Reactor *r = malloc(sizeof(Reactor));
+    assert(r);
+    r->epoll = epoll_create1(EPOLL_CLOEXEC);
+    if (r->epoll < 0)
+    {
+        perror("Failed to create epoll instance");
+        exit(1);
+    }
+    r->n_sources = 0;
+    return r;
+}
+
+
+// Also closes the timers and signalfds that the reactor made itself.
+void reactor_destroy(Reactor **r)
+{
+    Reactor *re = *r;
+    for (unsigned i = 0; i < re->n_sources; i++)
+        if (re->sources[i].kind != SOURCE_FD)
+            close(re->sources[i].fd);
+    close(re->epoll);
+    free(re);
+    *r = NULL;
+}
+
+
+static void add(
+    Reactor *r, int fd, uint32_t events, SourceKind kind,
+    ReactorHandler handler, void *arg
+)
+{
+    assert(r->n_sources < MAX_SOURCES);
+    Source *s = r->sources + r->n_sources++;
+    s->fd = fd;
+    s->kind = kind;
+    s->handler = handler;
+    s->arg = arg;
+
+    struct epoll_event ev = {.events = events, .data.ptr = s};
+    if (epoll_ctl(r->epoll, EPOLL_CTL_ADD, fd, &ev) < 0)
+    {
+        perror("Failed to watch file descriptor");
+        exit(1);
+    }
+}
+
+
+// Watch fd, which stays the caller's, for the given epoll events.
+void reactor_add(
+    Reactor *r, int fd, uint32_t events, ReactorHandler handler, void *arg
+)
+{
+    add(r, fd, events, SOURCE_FD, handler, arg);
+}
+
+
+/*
+Call handler every period seconds, starting one period from now. Expirations
+missed while the thread was busy are collapsed into one call. Returns the
+timerfd.
+*/
+int reactor_timer(Reactor *r, double period, ReactorHandler handler, void *arg)
+{
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    if (fd < 0)
+    {
+        perror("Failed to create timer");
+        exit(1);
+    }
+
+    struct timespec ts = {
+        .tv_sec = (time_t)period,
+        .tv_nsec = (long)(fmod(period, 1)*1e9),
+    };
+    struct itimerspec spec = {.it_interval = ts, .it_value = ts};
+    assert(timerfd_settime(fd, 0, &spec, NULL) == 0);
+
+    add(r, fd, EPOLLIN, SOURCE_TIMER, handler, arg);
+    return fd;
+}
+
+
+/*
+Deliver signo through the reactor instead of as an asynchronous signal. It's
+blocked on the calling thread, so this has to be called before any other
+threads are started, or they have to block it themselves. Returns the
+signalfd.
+*/
+int reactor_signal(Reactor *r, int signo, ReactorHandler handler, void *arg)
+{
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, signo);
+    assert(pthread_sigmask(SIG_BLOCK, &mask, NULL) == 0);
+
+    int fd = signalfd(-1, &mask, SFD_CLOEXEC | SFD_NONBLOCK);
+    if (fd < 0)
+    {
+        perror("Failed to create signalfd");
+        exit(1);
+    }
+
+    add(r, fd, EPOLLIN, SOURCE_SIGNAL, handler, arg);
+    return fd;
+}
+
+
+// Empty a timerfd or signalfd, so that it only fires again when it's due.
+static void drain(const Source *s)
+{
+    if (s->kind == SOURCE_TIMER)
+    {
+        uint64_t expirations;
+        while (read(s->fd, &expirations, sizeof(expirations)) > 0);
+    }
+    else if (s->kind == SOURCE_SIGNAL)
+    {
+        struct signalfd_siginfo info;
+        while (read(s->fd, &info, sizeof(info)) > 0);
+    }
+}
+
+
+/*
+Wait up to timeout_ms (-1 for ever) for any source to become ready, and
+dispatch every one that is. Returns false if any handler did, and true
+otherwise, including on timeout.
+*/
+bool reactor_run(Reactor *r, int timeout_ms)
+{
+    struct epoll_event events[MAX_EVENTS];
+    int n = epoll_wait(r->epoll, events, MAX_EVENTS, timeout_ms);
+    if (n < 0)
+    {
+        if (errno == EINTR)
+            return true;
+        perror("epoll_wait failed");
+        exit(1);
+    }
+
+    bool carry_on = true;
+    for (int i = 0; i < n; i++)
+    {
+        const Source *s = events[i].data.ptr;
+        drain(s);
+        if (!s->handler(s->fd, events[i].events, s->arg))
+            carry_on = false;
+    }
+    return carry_on;
+}
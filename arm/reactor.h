@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+struct ReactorTag;
+typedef struct ReactorTag Reactor;
+
+
+// Called when fd is ready, with the epoll events that it's ready for. Returns
+// false to have reactor_run() return false, e.g. to stop the loop.
+typedef bool (*ReactorHandler)(int fd, uint32_t events, void *arg);
+
+
+Reactor *reactor_create(void);
+void reactor_destroy(Reactor **r);
+
+void reactor_add(
+    Reactor *r, int fd, uint32_t events, ReactorHandler handler, void *arg
+);
+int reactor_timer(Reactor *r, double period, ReactorHandler handler, void *arg);
+int reactor_signal(Reactor *r, int signo, ReactorHandler handler, void *arg);
+bool reactor_run(Reactor *r, int timeout_ms);
@@ -0,0 +1,198 @@
+#include <assert.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "receiver.h"
+#include "util.h"
+
+/*
+A software stand-in for the PIC on the gauge board, so that the gauge path can
+run, and be measured, on any Linux machine. The gauge writes to a pipe instead
+of SPI, and a thread of the receiver's own decodes what comes out of it byte
+for byte as pic/main.asm and pic/receive.inc do, keeping a log of every DAC
+load with the time it was read.
+
+The protocol is written out again here from the PIC source rather than shared
+with gauge.c, so that it checks gauge.c's encoding instead of repeating it.
+What isn't modelled is the PIC's timing: a pipe never overruns, so everything
+gauge.c writes arrives.
+*/
+
+// As in pic/receive.inc
+#define INDEX_POS 5
+#define N_DACS 8
+
+#define READ_SIZE 256
+
+
+struct ReceiverTag
+{
+    // The pipe: [0] is ours to read, [1] the gauge's to write and close.
+    int fds[2];
+    pthread_t thread;
+    bool stopped;
+
+    // Decoder state, as the PIC holds it: the DAC whose second byte is due,
+    // or 0 for none, and the high bits from its first byte.
+    uint8_t pending, high;
+    uint16_t dacs[N_DACS];
+
+    ReceiverUpdate *log;
+    unsigned capacity, n_log;
+    ReceiverStats stats;
+};
+
+
+static void load(Receiver *r, unsigned index, uint16_t value, double time)
+{
+    r->dacs[index] = value;
+    r->stats.updates++;
+    if (r->n_log < r->capacity)
+    {
+        r->log[r->n_log++] = (ReceiverUpdate){
+            .time = time, .index = index, .value = value
+        };
+    }
+    else
+        r->stats.unlogged++;
+}
+
+
+/*
+rx_dispatch and the dac_*_rx macros. A 10-bit DAC takes two bytes: its index
+and check bits (which have to be zero) with the top 2 bits of the value, then
+the low 8; it's only loaded once both are in. The 5-bit DAC takes one byte,
+whose low 5 bits are the value. Anything else is dropped.
+*/
+static void decode(Receiver *r, uint8_t b, double time)
+{
+    r->stats.bytes++;
+    if (r->pending)
+    {
+        load(r, r->pending, r->high << 8 | b, time);
+        r->pending = 0;
+        return;
+    }
+
+    unsigned index = b >> INDEX_POS;
+    switch (index)
+    {
+        case 1:
+        case 2:
+        case 5:
+            if ((b & ~3) != index << INDEX_POS)
+            {
+                r->stats.bad_checks++;
+                return;
+            }
+            r->pending = index;
+            r->high = b & 3;
+            break;
+
+        case 4:
+            load(r, index, b & ((1 << INDEX_POS) - 1), time);
+            break;
+
+        default:
+            r->stats.strays++;
+    }
+}
+
+
+static void *receiver_thread(void *arg)
+{
+    Receiver *r = arg;
+
+    // SIGINT is for the main thread to deal with.
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+    uint8_t buffer[READ_SIZE];
+    ssize_t n;
+    // Until the gauge closes its end
+    while ((n = read(r->fds[0], buffer, sizeof(buffer))) > 0)
+    {
+        double time = monotonic();
+        for (ssize_t i = 0; i < n; i++)
+            decode(r, buffer[i], time);
+    }
+    if (n < 0)
+        perror("Failed to read from the gauge");
+    return NULL;
+}
+
+
+// Start receiving, logging the first log_capacity updates.
+Receiver *receiver_create(unsigned log_capacity)
+{
+    Receiver *r = calloc(1, sizeof(Receiver));
+    assert(r);
+    if (pipe(r->fds) < 0)
+    {
+        perror("Failed to create the gauge pipe");
+        exit(1);
+    }
+
+    r->capacity = log_capacity;
+    r->log = malloc(log_capacity*sizeof(ReceiverUpdate));
+    assert(r->log || !log_capacity);
+
+    assert(pthread_create(&r->thread, NULL, receiver_thread, r) == 0);
+    return r;
+}
+
+
+/*
+Wait for the gauge to close the pipe, and for everything it wrote to be
+decoded. Only then are the log and stats safe to read.
+*/
+void receiver_stop(Receiver *r)
+{
+    if (r->stopped)
+        return;
+    assert(pthread_join(r->thread, NULL) == 0);
+    r->stopped = true;
+}
+
+
+void receiver_destroy(Receiver **r)
+{
+    receiver_stop(*r);
+    close((*r)->fds[0]);
+    free((*r)->log);
+    free(*r);
+    *r = NULL;
+}
+
+
+// The pipe's write end, for gauge_init_stream(), which closes it when done.
+int receiver_fd(const Receiver *r)
+{
+    return r->fds[1];
+}
+
+
+uint16_t receiver_dac(const Receiver *r, unsigned index)
+{
+    assert(index < N_DACS);
+    return r->dacs[index];
+}
+
+
+const ReceiverUpdate *receiver_log(const Receiver *r, unsigned *n)
+{
+    *n = r->n_log;
+    return r->log;
+}
+
+
+ReceiverStats receiver_stats(const Receiver *r)
+{
+    return r->stats;
+}
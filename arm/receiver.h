@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdint.h>
+
+
+struct ReceiverTag;
+typedef struct ReceiverTag Receiver;
+
+
+// One DAC load, when the PIC would have made it.
+typedef struct
+{
+    // monotonic() when the bytes that completed it were read.
+    double time;
+    // The DAC: 1, 2 or 5 for the 10-bit ones, 4 for the 5-bit one.
+    uint8_t index;
+    uint16_t value;
+} ReceiverUpdate;
+
+
+typedef struct
+{
+    unsigned long bytes, updates;
+    // 10-bit channels' first bytes with bad check bits, which the PIC resets
+    // on, and bytes that didn't start any channel, which it drops.
+    unsigned long bad_checks, strays;
+    // Updates that didn't fit in the log, and so are only counted.
+    unsigned long unlogged;
+} ReceiverStats;
+
+
+Receiver *receiver_create(unsigned log_capacity);
+void receiver_stop(Receiver *r);
+void receiver_destroy(Receiver **r);
+
+int receiver_fd(const Receiver *r);
+uint16_t receiver_dac(const Receiver *r, unsigned index);
+const ReceiverUpdate *receiver_log(const Receiver *r, unsigned *n);
+ReceiverStats receiver_stats(const Receiver *r);
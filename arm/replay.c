@@ -0,0 +1,224 @@
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "prof.h"
+#include "replay.h"
+
+/*
+A capture backend that serves samples out of a recording rather than the sound
+card, so that the whole pipeline can be run, benchmarked and profiled on any
+machine. The file is mapped into memory and handed to consume() a period at a
+time without copying, just like the ALSA mmap area.
+
+Files are either WAV (16-bit PCM, mono) or headerless S16_LE mono, for which
+the sampling rate has to be given.
+
+In paced mode, periods are released on an absolute monotonic schedule, the
+same way the sound card would release them. In fast mode they're released as
+quickly as they're asked for.
+*/
+
+
+struct ReplayTag
+{
+    const uint8_t *map;
+    size_t map_size;
+
+    const sample_t *samples;
+    size_t n_samples, pos;
+
+    unsigned rate, period;
+    bool fast;
+    struct timespec next;
+};
+
+
+static uint32_t le32(const uint8_t *p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+
+static uint16_t le16(const uint8_t *p)
+{
+    return p[0] | p[1] << 8;
+}
+
+
+static void fail(const char *filename, const char *why)
+{
+    fprintf(stderr, "Can't replay %s: %s\n", filename, why);
+    exit(1);
+}
+
+
+/*
+Find the samples in a RIFF/WAVE file. Chunks other than "fmt " and "data" are
+skipped.
+*/
+static void parse_wav(Replay *r, const char *filename)
+{
+    const uint8_t *p = r->map + 12, *end = r->map + r->map_size;
+    bool have_fmt = false;
+
+    while (p + 8 <= end)
+    {
+        uint32_t size = le32(p + 4);
+        const uint8_t *body = p + 8;
+        if (body + size > end)
+            size = end - body;  // Truncated recordings are still useful
+
+        if (!memcmp(p, "fmt ", 4))
+        {
+            if (size < 16)
+                fail(filename, "short fmt chunk");
+            uint16_t format = le16(body), channels = le16(body + 2),
+                     bits = le16(body + 14);
+            // 1 is PCM; 0xFFFE is WAVE_FORMAT_EXTENSIBLE, which is PCM too as
+            // far as 16-bit mono goes.
+            if (format != 1 && format != 0xFFFE)
+                fail(filename, "not PCM");
+            if (channels != 1)
+                fail(filename, "not mono");
+            if (bits != 8*sizeof(sample_t))
+                fail(filename, "not 16-bit");
+            r->rate = le32(body + 4);
+            have_fmt = true;
+        }
+        else if (!memcmp(p, "data", 4))
+        {
+            if (!have_fmt)
+                fail(filename, "data before fmt");
+            r->samples = (const sample_t*)body;
+            r->n_samples = size / sizeof(sample_t);
+            return;
+        }
+
+        // Chunks are padded to even lengths
+        p = body + size + (size & 1);
+    }
+    fail(filename, "no data chunk");
+}
+
+
+Replay *replay_open(
+    const char *filename, bool fast, unsigned raw_rate, unsigned period
+)
+{
+    Replay *r = malloc(sizeof(Replay));
+    assert(r);
+
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1)
+        fail(filename, strerror(errno));
+    struct stat st;
+    assert(fstat(fd, &st) == 0);
+    r->map_size = st.st_size;
+    if (r->map_size < sizeof(sample_t))
+        fail(filename, "empty");
+
+    r->map = mmap(NULL, r->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    assert(r->map != MAP_FAILED);
+    assert(close(fd) == 0);
+    // It's all going to be read front to back.
+    madvise((void*)r->map, r->map_size, MADV_SEQUENTIAL | MADV_WILLNEED);
+
+    if (r->map_size >= 12
+        && !memcmp(r->map, "RIFF", 4)
+        && !memcmp(r->map + 8, "WAVE", 4))
+        parse_wav(r, filename);
+    else
+    {
+        r->samples = (const sample_t*)r->map;
+        r->n_samples = r->map_size / sizeof(sample_t);
+        r->rate = raw_rate;
+    }
+
+    r->pos = 0;
+    r->period = period;
+    r->fast = fast;
+
+    printf(
+        "Replaying %s: %zu samples at %u Hz (%.1f s), %s\n",
+        filename, r->n_samples, r->rate, (double)r->n_samples / r->rate,
+        fast ? "as fast as possible" : "in real time"
+    );
+    return r;
+}
+
+
+void replay_close(Replay **r)
+{
+    assert(munmap((void*)(*r)->map, (*r)->map_size) == 0);
+    free(*r);
+    *r = NULL;
+}
+
+
+/*
+Wait until the next period is due, then pass it to consume(). Returns false,
+having consumed nothing, once there isn't a whole period left.
+*/
+bool replay_read(
+    Replay *r,
+    CaptureContext *ctx,
+    void (*consume)(
+        CaptureContext *cc,
+        const sample_t *restrict samples,
+        unsigned n,
+        void *p
+    ),
+    void *p
+)
+{
+    if (replay_eof(r))
+        return false;
+
+    if (!r->fast)
+    {
+        // The clock starts with the first read, like the sound card's would.
+        if (r->pos == 0)
+            assert(clock_gettime(CLOCK_MONOTONIC, &r->next) == 0);
+        PROF_BEGIN(PROF_CAPTURE_WAIT);
+        // The period is "captured" once its last sample would have been.
+        long ns = r->next.tv_nsec + (long)(1e9 * r->period / r->rate);
+        r->next.tv_sec += ns / 1000000000;
+        r->next.tv_nsec = ns % 1000000000;
+        while (clock_nanosleep(
+            CLOCK_MONOTONIC, TIMER_ABSTIME, &r->next, NULL
+        ) == EINTR);
+        PROF_END(PROF_CAPTURE_WAIT);
+    }
+
+    consume(ctx, r->samples + r->pos, r->period, p);
+    r->pos += r->period;
+    return true;
+}
+
+
+bool replay_eof(const Replay *r)
+{
+    return r->pos + r->period > r->n_samples;
+}
+
+
+bool replay_fast(const Replay *r)
+{
+    return r->fast;
+}
+
+
+unsigned replay_rate(const Replay *r)
+{
+    return r->rate;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "capture.h"
+
+
+struct ReplayTag;
+typedef struct ReplayTag Replay;
+
+
+Replay *replay_open(
+    const char *filename, bool fast, unsigned raw_rate, unsigned period
+);
+void replay_close(Replay **r);
+
+bool replay_read(
+    Replay *r,
+    CaptureContext *ctx,
+    void (*consume)(
+        CaptureContext *cc,
+        const sample_t *restrict samples,
+        unsigned n,
+        void *p
+    ),
+    void *p
+);
+
+bool replay_eof(const Replay *r);
+bool replay_fast(const Replay *r);
+unsigned replay_rate(const Replay *r);
@@ -0,0 +1,218 @@
+#include <assert.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+#include "pool.h"
+#include "rt.h"
+#include "vrb.h"
+
+/*
+Realtime mode, for when the tuner shares the Pi with other things. A page fault
+or a preemption in the capture loop can cost an xrun, so:
+- all memory is locked, present and future, and everything made after
+  rt_start() is faulted in as it's made rather than when it's first touched:
+  VRBs map with MAP_POPULATE, and malloc() comes out of a heap that's already
+  been faulted in, and is never given back;
+- VRBs can be backed by huge pages;
+- each thread is pinned to a CPU of its own, at a SCHED_FIFO priority; and
+- the parallel engine's workers go on whatever CPUs are left over, one each,
+  below the interrupt threads, so none of them competes with a thread that's
+  been given a CPU, nor holds up an interrupt.
+
+Every thread brackets its loop with rt_enter() and rt_leave(), realtime or not,
+so that rt_report() can say how many faults and context switches each one took
+while it was running, and whether any of this made a difference.
+*/
+
+// Heap to fault in up front, for whatever analysis allocates later.
+#define HEAP_RESERVE (8 << 20)
+/*
+SCHED_FIFO priority for the parallel engine's workers: below the kernel's
+interrupt threads, at 50, since what's left over for workers is usually CPU 0,
+where the interrupts go.
+*/
+#define WORKER_PRIORITY 40
+
+
+static bool enabled = false;
+static RTConfig config;
+
+// Per role: usage when it entered, and then how much it took before leaving.
+static struct rusage entered[N_RT_ROLES], used[N_RT_ROLES];
+static bool left[N_RT_ROLES];
+
+
+/*
+CPU 0 takes most interrupts, so it's left to everything else. Capture gets the
+highest priority, since it's the one that can't wait. On a machine with fewer
+than four CPUs, roles double up.
+*/
+RTConfig rt_defaults(void)
+{
+    return (RTConfig){
+        .cpus = {
+            [RT_CAPTURE] = 3,
+            [RT_ANALYSIS] = 2,
+            [RT_GAUGE] = 1,
+        },
+        .priorities = {
+            [RT_CAPTURE] = 80,
+            [RT_ANALYSIS] = 70,
+            [RT_GAUGE] = 60,
+        },
+        .huge_pages = false,
+    };
+}
+
+
+static void reserve_heap(bool huge)
+{
+    size_t PS = sysconf(_SC_PAGESIZE);
+    volatile uint8_t *heap = malloc(HEAP_RESERVE);
+    assert(heap);
+
+    // Transparent huge pages, if the kernel gives them out on request
+    if (huge)
+    {
+        size_t HPS = 2 << 20;
+        uintptr_t start = ((uintptr_t)heap + HPS - 1) & ~(HPS - 1),
+                  end = ((uintptr_t)heap + HEAP_RESERVE) & ~(HPS - 1);
+        if (end > start)
+            madvise((void*)start, end - start, MADV_HUGEPAGE);
+    }
+
+    for (size_t i = 0; i < HEAP_RESERVE; i += PS)
+        heap[i] = 0;
+    free((void*)heap);
+}
+
+
+/*
+Give the worker pool the CPUs that no role is pinned to, at WORKER_PRIORITY.
+With none left over, the pool is only the analysis thread, and the work isn't
+split at all, which beats workers queueing up behind the threads they'd help.
+*/
+static void spare_cpus(void)
+{
+    unsigned n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    cpu_set_t spare;
+    CPU_ZERO(&spare);
+    for (unsigned cpu = 0; cpu < n_cpus; cpu++)
+        CPU_SET(cpu, &spare);
+    for (unsigned r = 0; r < N_RT_ROLES; r++)
+        if (config.cpus[r] >= 0)
+            CPU_CLR(config.cpus[r] % n_cpus, &spare);
+
+    pool_cpus(&spare, WORKER_PRIORITY);
+}
+
+
+/*
+Go realtime. This has to come before the capture, analysis and gauge are set
+up, so that what they allocate is locked and faulted in as they do.
+*/
+void rt_start(const RTConfig *c)
+{
+    config = *c;
+    enabled = true;
+
+    // Never hand memory back to the kernel, nor get it in fresh mmaps, which
+    // would fault again.
+    mallopt(M_TRIM_THRESHOLD, -1);
+    mallopt(M_MMAP_MAX, 0);
+
+    if (mlockall(MCL_CURRENT | MCL_FUTURE))
+        perror("Failed to lock memory; it's only faulted in");
+
+    reserve_heap(c->huge_pages);
+    vrb_options(VRB_PREFAULT | (c->huge_pages ? VRB_HUGE_PAGES : 0));
+    spare_cpus();
+}
+
+
+// Place the calling thread as its role says, and start counting for it.
+void rt_enter(RTRole role)
+{
+    assert(role < N_RT_ROLES);
+
+    if (enabled && config.cpus[role] >= 0)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(config.cpus[role] % sysconf(_SC_NPROCESSORS_ONLN), &set);
+        int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (err)
+            fprintf(stderr, "Failed to pin to CPU: %s\n", strerror(err));
+    }
+    if (enabled && config.priorities[role] > 0)
+    {
+        struct sched_param param = {
+            .sched_priority = config.priorities[role]
+        };
+        int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if (err)
+            fprintf(stderr, "Failed to use SCHED_FIFO: %s\n", strerror(err));
+    }
+
+    getrusage(RUSAGE_THREAD, entered + role);
+}
+
+
+// Stop counting for the calling thread, which is done.
+void rt_leave(RTRole role)
+{
+    assert(role < N_RT_ROLES);
+    struct rusage now;
+    getrusage(RUSAGE_THREAD, &now);
+    used[role] = (struct rusage){
+        .ru_minflt = now.ru_minflt - entered[role].ru_minflt,
+        .ru_majflt = now.ru_majflt - entered[role].ru_majflt,
+        .ru_nvcsw = now.ru_nvcsw - entered[role].ru_nvcsw,
+        .ru_nivcsw = now.ru_nivcsw - entered[role].ru_nivcsw,
+    };
+    left[role] = true;
+}
+
+
+static void print_usage(const char *name, const struct rusage *u)
+{
+    fprintf(
+        stderr,
+        "  %-9s %8ld minor %6ld major faults, %8ld voluntary %6ld involuntary "
+        "switches\n",
+        name, u->ru_minflt, u->ru_majflt, u->ru_nvcsw, u->ru_nivcsw
+    );
+}
+
+
+/*
+Faults and context switches for each thread that has left, while it ran, and
+for the whole process since it started. Page faults in a running thread
+should be none at all in realtime mode; involuntary switches mean something
+else got its CPU.
+*/
+void rt_report(void)
+{
+    static const char *names[N_RT_ROLES] = {
+        [RT_CAPTURE] = "capture",
+        [RT_ANALYSIS] = "analysis",
+        [RT_GAUGE] = "gauge",
+    };
+
+    fprintf(stderr, "Resource usage%s:\n", enabled ? " (realtime)" : "");
+    for (unsigned r = 0; r < N_RT_ROLES; r++)
+        if (left[r])
+            print_usage(names[r], used + r);
+
+    struct rusage total;
+    getrusage(RUSAGE_SELF, &total);
+    print_usage("process", &total);
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdbool.h>
+
+
+// The threads that realtime mode places.
+typedef enum
+{
+    RT_CAPTURE,
+    RT_ANALYSIS,
+    RT_GAUGE,
+    N_RT_ROLES
+} RTRole;
+
+
+typedef struct
+{
+    // CPU for each role, or -1 to leave it to the scheduler.
+    int cpus[N_RT_ROLES];
+    // SCHED_FIFO priority for each role, or 0 to leave it as it is.
+    int priorities[N_RT_ROLES];
+    bool huge_pages;
+} RTConfig;
+
+
+RTConfig rt_defaults(void);
+void rt_start(const RTConfig *config);
+void rt_enter(RTRole role);
+void rt_leave(RTRole role);
+void rt_report(void);
@@ -0,0 +1,190 @@
+#include <assert.h>
+
+#if defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#elif defined(__AVX2__) && defined(__FMA__) || defined(__SSE__)
+#include <immintrin.h>
+#endif
+
+#include "freq.h"
+
+/*
+A hand-vectorised version of autocorrelate_dot(). Every cblas_sdot call there
+streams all of f0 back in from cache just to multiply it against one lag. Here
+LAG_BLOCK adjacent lags are computed per pass: each vector of f0 is loaded once
+and FMA'd into LAG_BLOCK accumulators, one per lag, against the (unaligned,
+overlapping) lagged vectors. That cuts the loads per FMA roughly in half and
+gives the core LAG_BLOCK independent dependency chains to hide FMA latency.
+
+The Pi 4's A72 gets NEON (ASIMD) with FMA; x86 development machines get AVX2
+with FMA or plain SSE. Anything else falls back to scalar C, which the compiler
+will vectorise as best it can.
+*/
+
+#define LAG_BLOCK 8
+
+
+#if defined(__ARM_NEON) && defined(__aarch64__)
+
+#define VLEN 4
+
+static void lag_block(
+    const float *restrict f0, unsigned ndp, unsigned i, float *restrict sums
+)
+{
+    float32x4_t acc[LAG_BLOCK];
+    for (unsigned l = 0; l < LAG_BLOCK; l++)
+        acc[l] = vdupq_n_f32(0);
+
+    const float *y = f0 - i;
+    for (unsigned k = 0; k + VLEN <= ndp; k += VLEN)
+    {
+        float32x4_t x = vld1q_f32(f0 + k);
+        for (unsigned l = 0; l < LAG_BLOCK; l++)
+            acc[l] = vfmaq_f32(acc[l], x, vld1q_f32(y + k - l));
+    }
+
+    for (unsigned l = 0; l < LAG_BLOCK; l++)
+        sums[l] = vaddvq_f32(acc[l]);
+}
+
+#elif defined(__AVX2__) && defined(__FMA__)
+
+#define VLEN 8
+
+static float hsum(__m256 v)
+{
+    __m128 s = _mm_add_ps(
+        _mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1)
+    );
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_movehdup_ps(s));
+    return _mm_cvtss_f32(s);
+}
+
+static void lag_block(
+    const float *restrict f0, unsigned ndp, unsigned i, float *restrict sums
+)
+{
+    __m256 acc[LAG_BLOCK];
+    for (unsigned l = 0; l < LAG_BLOCK; l++)
+        acc[l] = _mm256_setzero_ps();
+
+    const float *y = f0 - i;
+    for (unsigned k = 0; k + VLEN <= ndp; k += VLEN)
+    {
+        __m256 x = _mm256_loadu_ps(f0 + k);
+        for (unsigned l = 0; l < LAG_BLOCK; l++)
+        {
+            acc[l] = _mm256_fmadd_ps(
+                x, _mm256_loadu_ps(y + k - l), acc[l]
+            );
+        }
+    }
+
+    for (unsigned l = 0; l < LAG_BLOCK; l++)
+        sums[l] = hsum(acc[l]);
+}
+
+#elif defined(__SSE__)
+
+#define VLEN 4
+
+static float hsum(__m128 s)
+{
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+    return _mm_cvtss_f32(s);
+}
+
+static void lag_block(
+    const float *restrict f0, unsigned ndp, unsigned i, float *restrict sums
+)
+{
+    __m128 acc[LAG_BLOCK];
+    for (unsigned l = 0; l < LAG_BLOCK; l++)
+        acc[l] = _mm_setzero_ps();
+
+    const float *y = f0 - i;
+    for (unsigned k = 0; k + VLEN <= ndp; k += VLEN)
+    {
+        __m128 x = _mm_loadu_ps(f0 + k);
+        for (unsigned l = 0; l < LAG_BLOCK; l++)
+        {
+            acc[l] = _mm_add_ps(
+                acc[l], _mm_mul_ps(x, _mm_loadu_ps(y + k - l))
+            );
+        }
+    }
+
+    for (unsigned l = 0; l < LAG_BLOCK; l++)
+        sums[l] = hsum(acc[l]);
+}
+
+#else
+
+#define VLEN 1
+
+static void lag_block(
+    const float *restrict f0, unsigned ndp, unsigned i, float *restrict sums
+)
+{
+    for (unsigned l = 0; l < LAG_BLOCK; l++)
+    {
+        float s = 0;
+        for (unsigned k = 0; k < ndp; k++)
+            s += f0[k] * (f0 - i - l)[k];
+        sums[l] = s;
+    }
+}
+
+#endif
+
+
+static float dot_tail(const float *f0, unsigned from, unsigned ndp, unsigned i)
+{
+    float s = 0;
+    for (unsigned k = from; k < ndp; k++)
+        s += f0[k] * (f0 - i)[k];
+    return s;
+}
+
+
+/*
+Compute lags [lo, hi) of the autocorrelation with the same contract and
+layout as autocorrelate_dot(): f0 = f + nac, ndp = nf - nac, and ac[i] gets
+the mean of f0(k)*f0(k - i) added to it. Splitting the lags this way lets
+callers share the work out or skip lags they don't care about.
+*/
+void autocorrelate_lags(
+    const float *f, unsigned nf, float *ac, unsigned nac,
+    unsigned lo, unsigned hi
+)
+{
+    assert(nf > nac);
+    assert(lo <= hi && hi <= nac);
+
+    unsigned ndp = nf - nac,
+             vec_end = ndp - ndp%VLEN;
+    const float *f0 = f + nac;
+    float scale = 1.f / ndp;
+
+    unsigned i = lo;
+    for (; i + LAG_BLOCK <= hi; i += LAG_BLOCK)
+    {
+        float sums[LAG_BLOCK];
+        lag_block(f0, ndp, i, sums);
+        for (unsigned l = 0; l < LAG_BLOCK; l++)
+            ac[i + l] += (sums[l] + dot_tail(f0, vec_end, ndp, i + l))*scale;
+    }
+
+    // Leftover lags that don't fill a block
+    for (; i < hi; i++)
+        ac[i] += dot_tail(f0, 0, ndp, i)*scale;
+}
+
+
+void autocorrelate_simd(float *f, unsigned nf, float *ac, unsigned nac)
+{
+    autocorrelate_lags(f, nf, ac, nac, 0, nac);
+}
@@ -0,0 +1,263 @@
+#include <assert.h>
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <fftw3.h>
+
+#include "freq.h"
+#include "spectrum.h"
+
+/*
+The spectral engine of python/fft.py, in C. Once a key is set, every update
+takes an FFT of the last second or so of history (a power of two of samples, as
+params.n_fft_in), splits the half-spectrum into one band per harmonic of the
+key, and finds each band's peak. The band bounds are the ones fft.py's
+coefficients give: geometric means of neighbouring harmonics, so band h runs
+from sqrt(h(h - 1)) to sqrt(h(h + 1)) times the key's frequency, with the
+fundamental's starting at 1/sqrt(2) of it. That includes fft.py's bins per Hz,
+n_fft_out/f_upper, which is a hair off the true n/rate; the peaks themselves
+are placed with the true one.
+
+Unlike fft.py, the window is Hann rather than rectangular, and each peak is
+interpolated between bins from the log power of its neighbours, which for a
+Hann window is good to well under a cent. Without that, a bin is over a cent
+wide for most of the keyboard.
+
+Planning a transform this long with FFTW_MEASURE takes a while, so wisdom is
+kept in a file, as fft.py keeps it in .fftw_wisdom_float; it's the same format,
+so one can use the other's.
+*/
+
+// How much audio each transform covers, at least; params.t_window_min.
+#define WINDOW_SECONDS 1
+
+
+struct SpectrumTag
+{
+    unsigned rate, n;
+    float *window, *in;
+    fftwf_complex *out;
+    fftwf_plan plan;
+
+    // The key's frequency, and each harmonic's band of bins, [lo, hi).
+    float f;
+    unsigned lo[SPECTRUM_HARMONICS], hi[SPECTRUM_HARMONICS];
+    Partial partials[SPECTRUM_HARMONICS];
+};
+
+
+static unsigned next_pow_2(unsigned x)
+{
+    unsigned p = 1;
+    while (p < x)
+        p <<= 1;
+    return p;
+}
+
+
+// How long the transform is at the given rate: a power of two of samples.
+unsigned spectrum_size(unsigned rate)
+{
+    return next_pow_2(WINDOW_SECONDS*rate);
+}
+
+
+/*
+The bins, [lo[h], hi[h]), in which to look for each harmonic of f in an
+n-point transform at the given rate.
+*/
+void spectrum_bands(
+    unsigned rate, unsigned n, float f,
+    unsigned lo[SPECTRUM_HARMONICS], unsigned hi[SPECTRUM_HARMONICS]
+)
+{
+    unsigned n_out = n/2 + 1;
+    double per_hz = n_out / (rate/2.);
+    unsigned bounds[SPECTRUM_HARMONICS + 1];
+    for (unsigned h = 0; h <= SPECTRUM_HARMONICS; h++)
+    {
+        double c = h ? sqrt(h*(h + 1.)) : M_SQRT1_2;
+        bounds[h] = rint(f * per_hz * c);
+        // Room for a neighbour either side of any peak
+        if (bounds[h] < 1)
+            bounds[h] = 1;
+        if (bounds[h] > n_out - 1)
+            bounds[h] = n_out - 1;
+    }
+    for (unsigned h = 0; h < SPECTRUM_HARMONICS; h++)
+    {
+        lo[h] = bounds[h];
+        hi[h] = bounds[h + 1];
+    }
+}
+
+
+/*
+Use wisdom from the given file, or from earlier in this run, if there's any for
+this transform, or else measure it and save what was learned. wisdom may be
+NULL to not keep any.
+*/
+static void plan(Spectrum *s, const char *wisdom)
+{
+    if (wisdom)
+        fftwf_import_wisdom_from_filename(wisdom);
+    s->plan = fftwf_plan_dft_r2c_1d(
+        s->n, s->in, s->out, FFTW_MEASURE | FFTW_WISDOM_ONLY
+    );
+    if (s->plan)
+        return;
+
+    printf("Planning a %u-point FFT...\n", s->n);
+    s->plan = fftwf_plan_dft_r2c_1d(s->n, s->in, s->out, FFTW_MEASURE);
+    assert(s->plan);
+    if (wisdom && !fftwf_export_wisdom_to_filename(wisdom))
+        fprintf(stderr, "Failed to save FFT wisdom to %s\n", wisdom);
+}
+
+
+Spectrum *spectrum_create(unsigned rate, const char *wisdom)
+{
+    Spectrum *s = malloc(sizeof(Spectrum));
+    assert(s);
+
+    s->rate = rate;
+    s->n = spectrum_size(rate);
+    s->window = fftwf_alloc_real(s->n);
+    s->in = fftwf_alloc_real(s->n);
+    s->out = fftwf_alloc_complex(s->n/2 + 1);
+    assert(s->window && s->in && s->out);
+
+    for (unsigned i = 0; i < s->n; i++)
+        s->window[i] = 0.5f - 0.5f*cosf(2*M_PI*i/s->n);
+
+    plan(s, wisdom);
+    s->f = 0;
+    return s;
+}
+
+
+void spectrum_destroy(Spectrum **s)
+{
+    fftwf_destroy_plan((*s)->plan);
+    fftwf_free((*s)->window);
+    fftwf_free((*s)->in);
+    fftwf_free((*s)->out);
+    free(*s);
+    *s = NULL;
+}
+
+
+// How many samples of history every update looks at.
+unsigned spectrum_length(const Spectrum *s)
+{
+    return s->n;
+}
+
+
+// Look for the harmonics of the given key, 0 for A0 up to N_NOTES - 1.
+void spectrum_set_note(Spectrum *s, unsigned key)
+{
+    assert(key < N_NOTES);
+    s->f = freq_of_key(key);
+    spectrum_bands(s->rate, s->n, s->f, s->lo, s->hi);
+    for (unsigned h = 0; h < SPECTRUM_HARMONICS; h++)
+        s->partials[h] = (Partial){.freq = -1, .cents = NAN, .magnitude = 0};
+}
+
+
+static float power(const fftwf_complex c)
+{
+    return c[0]*c[0] + c[1]*c[1];
+}
+
+
+// The strongest bin in harmonic h's band, placed between bins.
+static Partial peak(const Spectrum *s, unsigned h)
+{
+    unsigned best = s->lo[h];
+    float best_power = 0;
+    for (unsigned k = s->lo[h]; k < s->hi[h]; k++)
+    {
+        float p = power(s->out[k]);
+        if (p > best_power)
+        {
+            best_power = p;
+            best = k;
+        }
+    }
+    if (!(best_power > 0))
+        return (Partial){.freq = -1, .cents = NAN, .magnitude = 0};
+
+    // A Hann-windowed peak is close to a Gaussian, i.e. a parabola in log.
+    float a = logf(power(s->out[best - 1]) + FLT_MIN),
+          b = logf(best_power),
+          c = logf(power(s->out[best + 1]) + FLT_MIN),
+          curve = a - 2*b + c,
+          delta = curve < 0 ? 0.5f*(a - c)/curve : 0;
+
+    float f = (best + delta) * s->rate / s->n;
+    return (Partial){
+        .freq = f,
+        .cents = 1200*log2f(f / ((h + 1)*s->f)),
+        .magnitude = sqrtf(best_power),
+    };
+}
+
+
+/*
+Transform the last spectrum_length() samples of hist, which holds samples in
+the given format, and find every harmonic's peak in it.
+*/
+void spectrum_update(Spectrum *s, VRB *hist, VRBFormat format)
+{
+    assert(s->f > 0);
+    if (format == VRB_S16)
+    {
+        const int16_t *x = vrb_past(hist, s->n*sizeof(int16_t));
+        for (unsigned i = 0; i < s->n; i++)
+            s->in[i] = x[i] * s->window[i];
+    }
+    else
+    {
+        const float *x = vrb_past(hist, s->n*sizeof(float));
+        for (unsigned i = 0; i < s->n; i++)
+            s->in[i] = x[i] * s->window[i];
+    }
+
+    fftwf_execute(s->plan);
+
+    for (unsigned h = 0; h < SPECTRUM_HARMONICS; h++)
+        s->partials[h] = peak(s, h);
+}
+
+
+// Each harmonic's peak as of the last update, the fundamental first.
+const Partial *spectrum_partials(const Spectrum *s)
+{
+    return s->partials;
+}
+
+
+/*
+The fundamental, as implied by the strongest of the given partials, since in
+the bass the fundamental itself is often the weakest. Negative if there's
+nothing at all.
+*/
+float partials_freq(const Partial partials[SPECTRUM_HARMONICS])
+{
+    unsigned best = 0;
+    for (unsigned h = 1; h < SPECTRUM_HARMONICS; h++)
+        if (partials[h].magnitude > partials[best].magnitude)
+            best = h;
+    const Partial *p = partials + best;
+    return p->magnitude > 0 ? p->freq / (best + 1) : -1;
+}
+
+
+// The fundamental as of the last update; see partials_freq().
+float spectrum_freq(const Spectrum *s)
+{
+    return partials_freq(s->partials);
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "vrb.h"
+
+
+// Partials looked for, fundamental included; python/params.py's n_harmonics.
+#define SPECTRUM_HARMONICS 5
+
+
+struct SpectrumTag;
+typedef struct SpectrumTag Spectrum;
+
+
+typedef struct
+{
+    // Where the partial's peak is, how far that is from the key's harmonic,
+    // and how strong it is.
+    float freq, cents, magnitude;
+} Partial;
+
+
+unsigned spectrum_size(unsigned rate);
+void spectrum_bands(
+    unsigned rate, unsigned n, float f,
+    unsigned lo[SPECTRUM_HARMONICS], unsigned hi[SPECTRUM_HARMONICS]
+);
+float partials_freq(const Partial partials[SPECTRUM_HARMONICS]);
+
+Spectrum *spectrum_create(unsigned rate, const char *wisdom);
+void spectrum_destroy(Spectrum **s);
+
+unsigned spectrum_length(const Spectrum *s);
+void spectrum_set_note(Spectrum *s, unsigned key);
+void spectrum_update(Spectrum *s, VRB *hist, VRBFormat format);
+const Partial *spectrum_partials(const Spectrum *s);
+float spectrum_freq(const Spectrum *s);
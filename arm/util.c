@@ -1,7 +1,11 @@
 #include <assert.h>
+#include <errno.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <math.h>
+#include <time.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
 
 #include "util.h"
 
@@ -52,3 +56,35 @@ void save(void *mem, size_t size, const char *fn)
 
     assert(close(f) == 0);
 }
+
+
+// Seconds on the monotonic clock, for timing things.
+double monotonic(void)
+{
+    struct timespec t;
+    assert(clock_gettime(CLOCK_MONOTONIC, &t) == 0);
+    return t.tv_sec + t.tv_nsec*1e-9;
+}
+
+
+/*
+Thin wrappers around the futex syscall, which glibc doesn't expose. Sleep until
+*addr is woken, unless it no longer holds val, in which case return right away.
+Spurious wakeups are possible, so callers must re-check their condition.
+*/
+void futex_wait(_Atomic uint32_t *addr, uint32_t val)
+{
+    long err = syscall(
+        SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0
+    );
+    assert(err == 0 || errno == EAGAIN || errno == EINTR);
+}
+
+
+// Wake up to n waiters on addr; INT_MAX for all of them.
+void futex_wake(_Atomic uint32_t *addr, int n)
+{
+    assert(syscall(
+        SYS_futex, addr, FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0
+    ) != -1);
+}
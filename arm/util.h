@@ -1,3 +1,5 @@
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdlib.h>
 
 // determines the length of a static array.
@@ -6,3 +8,6 @@
 float mod1rd(float x);
 float clip(float x);
 void save(void *mem, size_t size, const char *fn);
+double monotonic(void);
+void futex_wait(_Atomic uint32_t *addr, uint32_t val);
+void futex_wake(_Atomic uint32_t *addr, int n);
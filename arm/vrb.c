@@ -4,6 +4,7 @@ typedef uint64_t u64;
 typedef int32_t i32;
 typedef int64_t i64;
 #include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <string.h>
@@ -14,23 +15,46 @@ typedef int64_t i64;
 #include "vrb.h"
 
 
+static unsigned options = 0;
+
+
 /*
-Make a new virtual ring buffer. Its length will be at least length bytes,
-rounded upward to the nearest multiple of the page size. (You should never need
-to know how big the pages are in order to use this code, but if for some reason
-you need to know the page size, use sysconf(_SC_PAGESIZE) from unistd.h to get
-it in bytes, as is standard practice on the unices.)
+Set options for every VRB made from now on, from VRBOption flags.
+VRB_PREFAULT has every page of both mirrors faulted in up front, rather than
+on first touch, which could be in the middle of capture. VRB_HUGE_PAGES backs
+VRBs with huge pages, if any have been reserved (vm.nr_hugepages); if not,
+they fall back to normal pages with a warning. Each VRB then takes at least a
+whole huge page, but that's one TLB entry instead of hundreds.
 */
-VRB *vrb_create(size_t length)
+void vrb_options(unsigned o)
 {
-    assert(length != 0);
+    options = o;
+}
 
-    VRB *b = malloc(sizeof(VRB));
-    assert(b != NULL);
 
-    size_t PS = sysconf(_SC_PAGESIZE);
-    b->length = length - 1 + PS - (length - 1)%PS;
+// The default huge page size, from /proc/meminfo, or 0 if unknown.
+static size_t huge_page_size(void)
+{
+    FILE *f = fopen("/proc/meminfo", "r");
+    if (!f)
+        return 0;
+    char line[128];
+    size_t kb = 0;
+    while (fgets(line, sizeof(line), f))
+        if (sscanf(line, "Hugepagesize: %zu kB", &kb) == 1)
+            break;
+    fclose(f);
+    return kb*1024;
+}
+
 
+/*
+Map b->length bytes twice over, with the mirror right after the original, in
+pages of PS bytes. Returns false if it couldn't, which can only happen with
+huge pages.
+*/
+static bool map_mirrors(VRB *b, size_t PS, bool huge)
+{
     /*
     Getting two independent mmaps, A and B, right next to each other is tricky.
     We don't care where A:B goes in memory, as long as A is right next to B.
@@ -52,16 +76,24 @@ VRB *vrb_create(size_t length)
     B inside that region. After that, the original dummy allocation will have
     been totally deallocated, but will have served its purpose, which was to
     find a place where A:B can go.
+
+    Huge pages have to be mapped at a multiple of their size, which the dummy
+    allocation needn't be, so for those it has a page to spare, and A goes at
+    the first multiple in it.
     */
-    b->mem = mmap(
+    size_t align = huge ? PS : 0;
+    void *region = mmap(
         NULL,  // requested starting address
-        2*b->length,
+        2*b->length + align,
         PROT_READ | PROT_WRITE,
         MAP_SHARED | MAP_ANONYMOUS,
         -1,  // fd
         0  // offset within file
     );
-    assert(b->mem != MAP_FAILED);
+    assert(region != MAP_FAILED);
+    b->mem = align
+        ? (void*)(((uintptr_t)region + align - 1) & ~(uintptr_t)(align - 1))
+        : region;
 
     /*
     mmap can not arbitrarily remap memory regions to other regions by address.
@@ -71,23 +103,36 @@ VRB *vrb_create(size_t length)
     CLOEXEC is not on by default, but is a good default, lol. Just look it up
     in man 2 memfd_create for more.
     */
-    int fd = memfd_create("VRB", MFD_CLOEXEC);
-    ftruncate(fd, b->length);
-
-    void *maddr = mmap(
-        b->mem,
-        b->length,
-        PROT_READ | PROT_WRITE,
-        MAP_SHARED | MAP_FIXED,
-        fd,
-        0
-    );
+    int fd = memfd_create("VRB", MFD_CLOEXEC | (huge ? MFD_HUGETLB : 0));
+    // MAP_POPULATE on a shared mapping faults every page in for writing.
+    int populate = options & VRB_PREFAULT ? MAP_POPULATE : 0;
+    void *maddr = MAP_FAILED;
+    if (fd >= 0 && ftruncate(fd, b->length) == 0)
+    {
+        maddr = mmap(
+            b->mem,
+            b->length,
+            PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_FIXED | populate,
+            fd,
+            0
+        );
+    }
+    if (maddr == MAP_FAILED)
+    {
+        // Only huge pages can run out.
+        assert(huge);
+        if (fd >= 0)
+            close(fd);
+        assert(munmap(region, 2*b->length + align) == 0);
+        return false;
+    }
     assert(maddr == b->mem);
     maddr = mmap(
         b->mem + b->length,
         b->length,
         PROT_READ | PROT_WRITE,
-        MAP_SHARED | MAP_FIXED,
+        MAP_SHARED | MAP_FIXED | populate,
         fd,
         0
     );
@@ -99,7 +144,50 @@ VRB *vrb_create(size_t length)
     */
     assert(close(fd) == 0);
 
+    // Whatever of the dummy allocation A:B didn't need
+    if (align)
+    {
+        size_t head = b->mem - region, tail = align - head;
+        if (head)
+            assert(munmap(region, head) == 0);
+        if (tail)
+            assert(munmap(b->mem + 2*b->length, tail) == 0);
+    }
+    return true;
+}
+
+
+/*
+Make a new virtual ring buffer. Its length will be at least length bytes,
+rounded upward to the nearest multiple of the page size. (You should never need
+to know how big the pages are in order to use this code, but if for some reason
+you need to know the page size, use sysconf(_SC_PAGESIZE) from unistd.h to get
+it in bytes, as is standard practice on the unices.)
+*/
+VRB *vrb_create(size_t length)
+{
+    assert(length != 0);
+
+    VRB *b = malloc(sizeof(VRB));
+    assert(b != NULL);
+
+    size_t HPS = options & VRB_HUGE_PAGES ? huge_page_size() : 0;
+    b->length = HPS ? length - 1 + HPS - (length - 1)%HPS : 0;
+    if (!HPS || !map_mirrors(b, HPS, true))
+    {
+        if (HPS)
+        {
+            fputs("No huge pages to spare; using normal pages\n", stderr);
+            options &= ~VRB_HUGE_PAGES;
+        }
+        size_t PS = sysconf(_SC_PAGESIZE);
+        b->length = length - 1 + PS - (length - 1)%PS;
+        assert(map_mirrors(b, PS, false));
+    }
+
     b->present = b->mem;
+    atomic_init(&b->written, 0);
+    atomic_init(&b->claimed, 0);
 
     return b;
 }
@@ -115,12 +203,18 @@ void vrb_destroy(VRB *b)
 /*
 Move b->present ahead by length bytes. Meant to be done after writing length
 bytes to b->present, so advances of more than b->length are considered invalid.
+Only one thread may advance a given VRB.
 */
 void vrb_advance(VRB *b, size_t length)
 {
     assert(length <= b->length);
     size_t i = b->present - b->mem;
     b->present = b->mem + (i + length)%b->length;
+
+    size_t written = atomic_load_explicit(&b->written, memory_order_relaxed);
+    atomic_store_explicit(
+        &b->written, written + length, memory_order_release
+    );
 }
 
 
@@ -141,3 +235,151 @@ void *vrb_past(VRB *b, size_t length)
     size_t i_past = (i + b->length - length)%b->length;
     return b->mem + i_past;
 }
+
+
+/*
+How many bytes have ever been advanced past. Safe to call from a thread other
+than the writer; everything written before the returned count is visible.
+*/
+size_t vrb_written(VRB *b)
+{
+    return atomic_load_explicit(&b->written, memory_order_acquire);
+}
+
+
+/*
+Say that the next length bytes from present are about to be written, before
+writing them, for readers on other threads that check what they've read with
+vrb_cursor_overwritten(). vrb_advance() then publishes them as usual.
+*/
+void vrb_claim(VRB *b, size_t length)
+{
+    assert(length <= b->length);
+    size_t written = atomic_load_explicit(&b->written, memory_order_relaxed);
+    atomic_store_explicit(&b->claimed, written + length, memory_order_relaxed);
+    // Nothing written after this can be seen before the claim is.
+    atomic_thread_fence(memory_order_release);
+}
+
+
+/*
+Start a cursor over b, whose elements are size bytes, at the writer's present,
+so that there's nothing to read until it advances. The reader may look up to
+history elements back from the cursor, so that much has to be left intact
+behind it.
+*/
+void vrb_cursor_init(VRBCursor *c, VRB *b, size_t size, size_t history)
+{
+    assert(b->length % size == 0);
+    assert(history*size <= b->length);
+    c->source = b;
+    c->size = size;
+    c->history = history;
+    c->lost = 0;
+
+    size_t written = vrb_written(b);
+    c->view.length = b->length;
+    c->view.mem = b->mem;
+    c->view.present = b->mem + written%b->length;
+    atomic_init(&c->view.written, written);
+    atomic_init(&c->view.claimed, 0);
+}
+
+
+/*
+How many elements the writer has advanced past that the cursor hasn't yet, i.e.
+how far behind it is. Only the cursor's reader may call this.
+*/
+size_t vrb_cursor_pending(VRBCursor *c)
+{
+    size_t cursor = atomic_load_explicit(
+        &c->view.written, memory_order_relaxed
+    );
+    return (vrb_written(c->source) - cursor)/c->size;
+}
+
+
+/*
+Move the cursor ahead over n elements, which have to be pending. If the writer
+has lapped it, overwriting any of the history that the reader would look back
+over from there, it jumps to the writer's present instead, and the number of
+elements skipped beyond the n is returned (and added to c->lost). Anything
+the reader worked out from the old history is then no good. Otherwise, it
+returns 0. This only says what's intact as of the call: either the writer has
+to be kept far enough behind the cursor's history that it can't reach it while
+the reader is still at it, or the reader has to check afterwards with
+vrb_cursor_overwritten().
+*/
+size_t vrb_cursor_advance(VRBCursor *c, size_t n)
+{
+    VRB *v = &c->view;
+    size_t cursor = atomic_load_explicit(&v->written, memory_order_relaxed),
+           written = vrb_written(c->source),
+           target = cursor + n*c->size;
+    assert(written - cursor >= n*c->size);
+
+    // After advancing, the reader will use [target - history, target).
+    if (written - target + c->history*c->size <= v->length)
+    {
+        vrb_advance(v, n*c->size);
+        return 0;
+    }
+
+    // Seek straight to the writer's present
+    v->present = v->mem + written%v->length;
+    atomic_store_explicit(&v->written, written, memory_order_release);
+    size_t lost = (written - target)/c->size;
+    c->lost += lost;
+    return lost;
+}
+
+
+/*
+How many of the history elements behind the cursor the writer has written
+over, or claimed to be about to, since the cursor last moved; 0 if they're all
+as they were. vrb_cursor_advance() only checks them as of when it moves, so a
+reader that can be lapped while it's still working on them calls this once
+it's done, to find out whether what it read then can be trusted, the way a
+seqlock reader checks its sequence number.
+*/
+size_t vrb_cursor_overwritten(VRBCursor *c)
+{
+    // Whatever was read before this is read before the counts are.
+    atomic_thread_fence(memory_order_acquire);
+    size_t written = atomic_load_explicit(
+               &c->source->written, memory_order_relaxed
+           ),
+           claimed = atomic_load_explicit(
+               &c->source->claimed, memory_order_relaxed
+           ),
+           cursor = atomic_load_explicit(
+               &c->view.written, memory_order_relaxed
+           ),
+           reach = claimed > written ? claimed : written,
+           start = cursor - c->history*c->size;
+    if (reach - start <= c->view.length)
+        return 0;
+    size_t over = (reach - start - c->view.length)/c->size;
+    return over < c->history ? over : c->history;
+}
+
+
+// The n elements just before the cursor, and after them whatever it hasn't read.
+void *vrb_cursor_past(VRBCursor *c, size_t n)
+{
+    return vrb_past(&c->view, n*c->size);
+}
+
+
+const float *vrb_cursor_floats(VRBCursor *c, size_t n)
+{
+    assert(c->size == sizeof(float));
+    return vrb_cursor_past(c, n);
+}
+
+
+const int16_t *vrb_cursor_s16(VRBCursor *c, size_t n)
+{
+    assert(c->size == sizeof(int16_t));
+    return vrb_cursor_past(c, n);
+}
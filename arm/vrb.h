@@ -1,5 +1,7 @@
 #pragma once
+#include <stdatomic.h>
 #include <stddef.h>
+#include <stdint.h>
 
 // This ring buffer isn't being used as a FIFO. It's being used to save length
 // bytes of a stream's immediate past, so that it can be recalled for various
@@ -13,9 +15,61 @@ typedef struct {
     // The next location to be written to. Will always be in the first of the
     // two mirrors.
     void *present;
+    // Total bytes ever advanced past. Published with release semantics, so
+    // that another thread can see how far the writer has got without racing
+    // on present.
+    _Atomic size_t written;
+    // How far the writer has said it's about to write up to, with
+    // vrb_claim(), so that a reader can tell whether it's been written over
+    // even before the writer advances.
+    _Atomic size_t claimed;
 } VRB;
 
+// What a VRB of audio holds: floats, or int16s for the fixed-point path.
+typedef enum {
+    VRB_FLOAT,
+    VRB_S16
+} VRBFormat;
+
+static inline size_t vrb_format_size(VRBFormat format)
+{
+    return format == VRB_S16 ? sizeof(int16_t) : sizeof(float);
+}
+
+/*
+A reader's own position in a VRB, so that any number of readers can follow one
+writer, each at its own pace, with none of them copying anything. The view is
+a VRB over the same memory whose present is the read position, so vrb_past()
+on it, and anything else that takes a VRB, works from there. Counts are in
+elements rather than bytes.
+*/
+typedef struct {
+    VRB view;
+    VRB *source;
+    // Bytes per element, and elements the reader looks back behind the cursor.
+    size_t size, history;
+    // Elements skipped over, in all, because the writer lapped the cursor.
+    size_t lost;
+} VRBCursor;
+
+// Flags for vrb_options()
+typedef enum {
+    VRB_PREFAULT = 1,
+    VRB_HUGE_PAGES = 2
+} VRBOption;
+
+void vrb_options(unsigned options);
 VRB *vrb_create(size_t length);
 void vrb_destroy(VRB *b);
 void vrb_advance(VRB *b, size_t length);
 void *vrb_past(VRB *b, size_t length);
+size_t vrb_written(VRB *b);
+void vrb_claim(VRB *b, size_t length);
+
+void vrb_cursor_init(VRBCursor *c, VRB *b, size_t size, size_t history);
+size_t vrb_cursor_pending(VRBCursor *c);
+size_t vrb_cursor_advance(VRBCursor *c, size_t n);
+size_t vrb_cursor_overwritten(VRBCursor *c);
+void *vrb_cursor_past(VRBCursor *c, size_t n);
+const float *vrb_cursor_floats(VRBCursor *c, size_t n);
+const int16_t *vrb_cursor_s16(VRBCursor *c, size_t n);
@@ -1,5 +1,7 @@
 #include <inttypes.h>
+#include <pthread.h>
 #include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <string.h>
@@ -10,6 +12,163 @@
 #include "util.h"
 #include "vrb.h"
 
+// Benchmark sizes: elements written per advance, and in all.
+#define BENCH_PERIOD 256
+#define BENCH_TOTAL (1u << 26)
+#define BENCH_READERS 3
+
+
+// Not inlined or analysed, so that summing the same thing twice isn't folded.
+__attribute__((noipa))
+static float sum_floats(const float *x, unsigned n)
+{
+    float s = 0;
+    for (unsigned i = 0; i < n; i++)
+        s += x[i];
+    return s;
+}
+
+
+/*
+One thread writes periods and every cursor reads each one straight after, so
+this is the cost of the cursors themselves (plus summing what they read), next
+to doing the same with a plain array and offsets worked out by hand.
+*/
+static void bench_lockstep(size_t PS)
+{
+    float *period = malloc(BENCH_PERIOD*sizeof(float));
+    assert(period);
+    for (unsigned i = 0; i < BENCH_PERIOD; i++)
+        period[i] = i;
+    volatile float sink = 0;
+
+    size_t length = 64*PS/sizeof(float);
+    float *plain = malloc(length*sizeof(float));
+    assert(plain);
+    double start = monotonic();
+    for (unsigned k = 0; k < BENCH_TOTAL/BENCH_PERIOD; k++)
+    {
+        float *present = plain + k*BENCH_PERIOD%length;
+        memcpy(present, period, BENCH_PERIOD*sizeof(float));
+        for (unsigned r = 0; r < BENCH_READERS; r++)
+            sink += sum_floats(present, BENCH_PERIOD);
+    }
+    double t_plain = monotonic() - start;
+    free(plain);
+
+    VRB *b = vrb_create(64*PS);
+    VRBCursor cursors[BENCH_READERS];
+    for (unsigned r = 0; r < BENCH_READERS; r++)
+        vrb_cursor_init(cursors + r, b, sizeof(float), BENCH_PERIOD);
+
+    start = monotonic();
+    for (unsigned k = 0; k < BENCH_TOTAL/BENCH_PERIOD; k++)
+    {
+        memcpy(b->present, period, BENCH_PERIOD*sizeof(float));
+        vrb_advance(b, BENCH_PERIOD*sizeof(float));
+        for (unsigned r = 0; r < BENCH_READERS; r++)
+        {
+            assert(vrb_cursor_pending(cursors + r) == BENCH_PERIOD);
+            assert(vrb_cursor_advance(cursors + r, BENCH_PERIOD) == 0);
+            sink += sum_floats(
+                vrb_cursor_floats(cursors + r, BENCH_PERIOD), BENCH_PERIOD
+            );
+        }
+    }
+    double t_cursors = monotonic() - start;
+    vrb_destroy(b);
+    free(period);
+
+    double n = (double)BENCH_TOTAL*BENCH_READERS;
+    printf(
+        "lockstep, %u readers: %.0f M elements/s through cursors, "
+        "%.0f M/s from a plain array\n",
+        BENCH_READERS, n/t_cursors/1e6, n/t_plain/1e6
+    );
+}
+
+
+typedef struct
+{
+    VRBCursor cursor;
+    _Atomic bool *done;
+    size_t read;
+    float sum;
+    double time;
+} Reader;
+
+
+static void *reader(void *arg)
+{
+    Reader *r = arg;
+    double start = monotonic();
+    while (true)
+    {
+        bool done = atomic_load_explicit(r->done, memory_order_acquire);
+        size_t n = vrb_cursor_pending(&r->cursor);
+        if (n >= BENCH_PERIOD)
+        {
+            vrb_cursor_advance(&r->cursor, BENCH_PERIOD);
+            r->read += BENCH_PERIOD;
+            r->sum += sum_floats(
+                vrb_cursor_floats(&r->cursor, BENCH_PERIOD), BENCH_PERIOD
+            );
+        }
+        else if (done)
+            break;
+    }
+    r->time = monotonic() - start;
+    return NULL;
+}
+
+
+/*
+A writer thread and a thread per cursor, all flat out, with nothing to keep the
+writer from lapping the readers: how fast each gets through, and how much it
+loses for being slower than the writer. With fewer CPUs than threads, that's
+mostly what the scheduler makes of it.
+*/
+static void bench_threads(size_t PS)
+{
+    VRB *b = vrb_create(64*PS);
+    _Atomic bool done;
+    atomic_init(&done, false);
+
+    Reader readers[BENCH_READERS];
+    pthread_t threads[BENCH_READERS];
+    for (unsigned r = 0; r < BENCH_READERS; r++)
+    {
+        readers[r] = (Reader){.done = &done, .read = 0, .sum = 0};
+        vrb_cursor_init(&readers[r].cursor, b, sizeof(float), BENCH_PERIOD);
+        assert(pthread_create(threads + r, NULL, reader, readers + r) == 0);
+    }
+
+    double start = monotonic();
+    for (unsigned k = 0; k < BENCH_TOTAL/BENCH_PERIOD; k++)
+    {
+        float *present = b->present;
+        for (unsigned i = 0; i < BENCH_PERIOD; i++)
+            present[i] = i;
+        vrb_advance(b, BENCH_PERIOD*sizeof(float));
+    }
+    double t_write = monotonic() - start;
+    atomic_store_explicit(&done, true, memory_order_release);
+
+    printf("threads: writer %.0f M elements/s", BENCH_TOTAL/t_write/1e6);
+    for (unsigned r = 0; r < BENCH_READERS; r++)
+    {
+        assert(pthread_join(threads[r], NULL) == 0);
+        printf(
+            "; reader %u %.0f M/s, lost %.1f%%", r,
+            readers[r].read/readers[r].time/1e6,
+            100.*readers[r].cursor.lost/BENCH_TOTAL
+        );
+    }
+    putchar('\n');
+    vrb_destroy(b);
+}
+
+
 int main(int argc, const char **argv)
 {
     srandom(time(NULL));
@@ -68,5 +227,89 @@ int main(int argc, const char **argv)
         vrb_destroy(b);
     }
 
+    // Test cursors: several readers, in element units, each at its own pace.
+    {
+        VRB *b = vrb_create(PS);
+        unsigned N = b->length / sizeof(int16_t);
+        VRBCursor fast, slow;
+        vrb_cursor_init(&fast, b, sizeof(int16_t), 16);
+        vrb_cursor_init(&slow, b, sizeof(int16_t), 16);
+        assert(vrb_cursor_pending(&fast) == 0);
+
+        int16_t *p = b->present;
+        for (unsigned x = 0; x < 100; x++)
+            p[x] = x;
+        vrb_advance(b, 100*sizeof(int16_t));
+        assert(vrb_cursor_pending(&fast) == 100);
+        assert(vrb_cursor_pending(&slow) == 100);
+
+        assert(vrb_cursor_advance(&fast, 60) == 0);
+        assert(vrb_cursor_pending(&fast) == 40);
+        const int16_t *y = vrb_cursor_s16(&fast, 60);
+        for (unsigned x = 0; x < 60; x++)
+            assert(y[x] == (int16_t)x);
+        // The slow one hasn't moved.
+        assert(vrb_cursor_pending(&slow) == 100);
+
+        // Lap the slow one. Only the last N - 16 are now safe to read up to.
+        for (unsigned k = 0; k < 2; k++)
+        {
+            p = b->present;
+            for (unsigned x = 0; x < N/2; x++)
+                p[x] = x;
+            vrb_advance(b, N/2*sizeof(int16_t));
+        }
+        assert(vrb_cursor_pending(&slow) == N + 100);
+        size_t lost = vrb_cursor_advance(&slow, 10);
+        assert(lost == N + 90);
+        assert(slow.lost == lost);
+        assert(vrb_cursor_pending(&slow) == 0);
+        y = vrb_cursor_s16(&slow, 16);
+        for (unsigned x = 0; x < 16; x++)
+            assert(y[x] == (int16_t)(N/2 - 16 + x));
+
+        // Close behind, but not lapped: still fine.
+        assert(vrb_cursor_advance(&fast, 40 + N - 16 - 100) == 0);
+        assert(fast.lost == 0);
+        vrb_destroy(b);
+    }
+
+    /*
+    Test overwrites after a cursor has moved, while its reader is still at
+    what's behind it, which only vrb_cursor_overwritten() can see.
+    */
+    {
+        VRB *b = vrb_create(PS);
+        unsigned N = b->length / sizeof(float);
+        VRBCursor c;
+        vrb_cursor_init(&c, b, sizeof(float), 16);
+
+        vrb_advance(b, 100*sizeof(float));
+        assert(vrb_cursor_advance(&c, 100) == 0);
+        assert(vrb_cursor_overwritten(&c) == 0);
+
+        // Right up to the oldest of the history, but not over it
+        vrb_advance(b, (N - 16)*sizeof(float));
+        assert(vrb_cursor_overwritten(&c) == 0);
+
+        // Claimed, but not yet advanced past: already not to be trusted.
+        vrb_claim(b, 5*sizeof(float));
+        assert(vrb_cursor_overwritten(&c) == 5);
+        vrb_advance(b, 5*sizeof(float));
+        assert(vrb_cursor_overwritten(&c) == 5);
+
+        // All of it, and then some
+        vrb_advance(b, 100*sizeof(float));
+        assert(vrb_cursor_overwritten(&c) == 16);
+
+        // Moving on past it leaves nothing to check until the writer laps again.
+        assert(vrb_cursor_advance(&c, 10) > 0);
+        assert(vrb_cursor_overwritten(&c) == 0);
+        vrb_destroy(b);
+    }
+
+    bench_lockstep(PS);
+    bench_threads(PS);
+
     return 0;
 }
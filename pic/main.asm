@@ -366,18 +366,58 @@ fade_disable:
     
 rx_reset:
     ; Reset the receiver state to here if something smells
-    dac_10b_rx 1
-    dac_10b_rx 2
-    dac_10b_rx 5
-    dac_5b_rx 4
     
-    ; until we get a serial interrupt for the first byte of the next packet
+    ; until we get a serial interrupt for the first byte of the next update
     sleep
     
     ; Since we were in sleep, we need to manually check for a timeout
-    btfsc nTO 
+    btfss nTO
+    reset
+    
+rx_dispatch:
+    ; Peek at the byte without taking it, and go to the receiver for the DAC
+    ; in its upper three bits; that receiver takes it and checks it again.
+    banksel SSP1BUF  ; 4
+    movf SSP1BUF, W
+    andlw 0b111 << index_posn
+    xorlw 1 << index_posn
+    btfsc ZERO
+    goto dac_rx_1_b1
+    xorlw (1 ^ 2) << index_posn
+    btfsc ZERO
+    goto dac_rx_2_b1
+    xorlw (2 ^ 5) << index_posn
+    btfsc ZERO
+    goto dac_rx_5_b1
+    xorlw (5 ^ 4) << index_posn
+    btfsc ZERO
+    goto dac_rx_4_b1
+    
+    ; Not the start of any channel; drop it
+    banksel PIR1  ; 0
+    bcf SSP1IF
+    
+rx_next:
+    ; The channels of one update come back to back, and waking from sleep
+    ; takes too long to catch the next one, so spin for a while first. W
+    ; counts 256 spins, about 200us.
+    movlw 0
+rx_spin:
+    banksel PIR1  ; 0
+    btfsc SSP1IF
+    bra rx_dispatch
+    addlw 1
+    btfss ZERO
+    bra rx_spin
     goto rx_reset
     
-    reset
+    dac_10b_rx 1
+    goto rx_next
+    dac_10b_rx 2
+    goto rx_next
+    dac_10b_rx 5
+    goto rx_next
+    dac_5b_rx 4
+    goto rx_next
     
     end por_vec
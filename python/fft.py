@@ -28,13 +28,48 @@ coefficients[0] /= params.SQ2
 coefficients[1:] *= np.sqrt(h_indices*(h_indices + 1))
 
 
+def harmonic_axes(note: int) -> tuple[
+    'np.ndarray[typing.Any, np.dtype[np.uint32]]',
+    'list[audio.SingleArray]',
+]:
+    """
+    Each harmonic's section of the full transform's bins as a [left, right)
+    row, and its cent axis.
+    """
+    f_tune_exact = params.n_to_f(note)
+
+    bounds_flat = np.empty(params.n_harmonics + 1, dtype=np.uint32)
+    np.rint(f_tune_exact * coefficients, casting='unsafe', out=bounds_flat)
+    bounds = np.vstack((bounds_flat[:-1], bounds_flat[1:])).T
+    sizes = (bounds[:, 1] - bounds[:, 0])[..., np.newaxis]
+    longest = np.max(sizes)
+
+    cents = np.linspace(bounds[:, 0], bounds[:, 0] + longest - 1, longest).T
+    cents *= (params.f_upper / f_tune_exact / params.n_fft_out / h_indices)[..., np.newaxis]
+    cents = 1_200 / params.LOG_2 * np.log(cents)
+
+    # This can't really be vectorized because these will be jagged.
+    return bounds, [
+        cent[:size[0]]
+        for cent, size in zip(cents, sizes)
+    ]
+
+
+def clip_harmonic(harm: 'audio.SingleArray') -> 'audio.SingleArray':
+    yfmax = np.max(harm, initial=0)
+    if yfmax > params.y_max:
+        harm *= params.y_max / yfmax
+    return harm
+
+
 class FFTError(Exception):
     pass
 
 
 class FFT:
-    def __init__(self, read_audio: 'audio.ReadFn') -> None:
+    def __init__(self, read_audio: 'audio.ReadFn', threads: int = cpu_count()) -> None:
         self.read_audio = read_audio
+        self.threads = threads
         self.fft_in = pyfftw.zeros_aligned(shape=params.n_fft_in, dtype=np.float32)
         self.fft_out = pyfftw.empty_aligned(shape=params.n_fft_out, dtype=np.complex64)
 
@@ -46,7 +81,7 @@ class FFT:
 
     def plan_fft(self) -> None:
         start = time.monotonic()
-        n_cpus = cpu_count()
+        n_cpus = self.threads
         types = ('double', 'float', 'ldouble')
         wisdom_fns = [Path(f'.fftw_wisdom_{t}') for t in types]
         has_wisdom = False
@@ -100,30 +135,13 @@ class FFT:
         print(f'{n_codelets} codelets in {end - start:.1f}s')
 
     def set_note(self, note: int) -> None:
-        f_tune_exact = params.n_to_f(note)
-
-        bounds_flat = np.empty(params.n_harmonics + 1, dtype=np.uint32)
-        np.rint(f_tune_exact * coefficients, casting='unsafe', out=bounds_flat)
-        bounds = np.vstack((bounds_flat[:-1], bounds_flat[1:])).T
-        sizes = (bounds[:, 1] - bounds[:, 0])[..., np.newaxis]
-        longest = np.max(sizes)
-
-        cents = np.linspace(bounds[:, 0], bounds[:, 0] + longest - 1, longest).T
-        cents *= (params.f_upper / f_tune_exact / params.n_fft_out / h_indices)[..., np.newaxis]
-        cents = 1_200 / params.LOG_2 * np.log(cents)
-
-        # This can't really be vectorized because these will be jagged.
-        self.cents = [
-            cent[:size[0]]
-            for cent, size in zip(cents, sizes)
-        ]
-
+        bounds, self.cents = harmonic_axes(note)
         self.harmonics = [
             self.fft_out[left: right]
             for left, right in bounds
         ]
 
-    def get_spectrum(self) -> 'AxisPair':
+    def shift_in(self) -> 'audio.SingleArray':
         # Read up to n_fft_in samples; usually it will be much smaller
         samples = self.read_audio(params.n_fft_in)
 
@@ -133,14 +151,160 @@ class FFT:
             self.fft_in[:-n] = self.fft_in[n:]
             # Copy new data into the end of the array
             self.fft_in[-n:] = samples
+        return samples
+
+    def get_spectrum(self) -> 'AxisPair':
+        if len(self.shift_in()):
+            self.fft()
+
+        return self.cents, [
+            clip_harmonic(np.abs(harm))
+            for harm in self.harmonics
+        ]
+
+
+def zoom_decimation(left: int, right: int) -> int:
+    # As far as leaves the section half of the new band; the other half is the
+    # filter's transition, so nothing aliases into the section.
+    width = max(right - left, 1)
+    decimation = params.prev_pow_2(params.n_fft_in / (2*width))
+    return max(1, min(params.n_fft_in, decimation))
+
+
+class Zoom:
+    """
+    A section of the full transform's bins, [left, right), worked out by zoom
+    FFT: mix left down to DC, band-pass and decimate, and transform what's
+    left. The decimated history still covers n_fft_in samples, so its bins are
+    the same width as the full transform's and line up with them exactly;
+    there are just far fewer of them.
+
+    Samples are fed in as they arrive, so each frame only filters what's new
+    rather than the whole window. The filter delays what's shown by half its
+    length, which is up to about 15ms in the bass and far less above.
+    """
+
+    def __init__(self, left: int, right: int) -> None:
+        n = params.n_fft_in
+        width = max(right - left, 1)
+        self.left = left
+
+        self.decimation = zoom_decimation(left, right)
+        self.n_zoom = n // self.decimation
+
+        # Windowed-sinc low-pass at half the new rate, moved up to the middle
+        # of the section. A Blackman window's transition is about 5.5/taps
+        # wide; this gives it a bit more room.
+        transition = (self.n_zoom - width) / n
+        n_taps = int(np.ceil(6.6 / transition)) | 1
+        m = np.arange(n_taps)
+        taps = (
+            np.sinc((m - (n_taps - 1)/2) / self.decimation) * np.blackman(n_taps)
+        )
+        taps = taps / taps.sum() * np.exp(2j*np.pi*width/2/n * m)
+        # Reversed, to be dotted with the window of samples that ends on each output
+        self.taps = taps[::-1].astype(np.complex64)
+
+        # The mixer repeats every n samples, since left is a whole bin; two
+        # periods, so that any frame's worth is one slice.
+        self.mixer = np.exp(-2j*np.pi*left/n * np.arange(2*n)).astype(np.complex64)
+        self.t = 0
+        self.tail = np.zeros(n_taps - 1, dtype=np.complex64)
+
+        self.zoom_in = pyfftw.zeros_aligned(shape=self.n_zoom, dtype=np.complex64)
+        self.zoom_out = pyfftw.empty_aligned(shape=self.n_zoom, dtype=np.complex64)
+        # Small enough that more threads would only slow it down
+        self.fft = pyfftw.FFTW(
+            self.zoom_in, self.zoom_out,
+            direction='FFTW_FORWARD',
+            flags=('FFTW_MEASURE',),
+            threads=1,
+        )
+
+    def feed(self, samples: 'audio.SingleArray') -> None:
+        n = len(samples)
+        buffer = np.concatenate((self.tail, samples * self.mixer[self.t: self.t + n]))
+        self.tail = buffer[n:]
+
+        # The window of taps ending on the sample at t + i is buffer[i:], so
+        # take those that end on the decimated grid.
+        first = -self.t % self.decimation
+        n_zoomed = max(0, n - first + self.decimation - 1) // self.decimation
+        windows = np.lib.stride_tricks.as_strided(
+            buffer[first:],
+            shape=(n_zoomed, len(self.taps)),
+            strides=(self.decimation*buffer.itemsize, buffer.itemsize),
+            writeable=False,
+        )
+        zoomed = np.dot(windows, self.taps)
+        self.t = (self.t + n) % params.n_fft_in
+
+        z = min(len(zoomed), self.n_zoom)
+        if z:
+            self.zoom_in[:-z] = self.zoom_in[z:]
+            self.zoom_in[-z:] = zoomed[-z:]
+
+    def bins(self, left: int, right: int) -> 'audio.SingleArray':
+        return self.zoom_out[left - self.left: right - self.left]
+
+
+class ZoomFFT(FFT):
+    """
+    Only works out the bins that are shown: one zoom FFT over all of the
+    harmonic sections, planned on each set_note(), rather than the whole
+    n_fft_in-sample transform every frame. For most of the keyboard that's a
+    transform of a few thousand points, which doesn't need every core.
+
+    The history is still kept, so that a new note's zoom can be primed from it
+    and show a full window straight away. Near the top, the sections cover
+    most of the spectrum and there's nothing to gain by zooming, so the full
+    transform is used there, on one thread.
+    """
+
+    # Least decimation worth zooming for; a complex transform of half the
+    # points costs about what the full real one does.
+    DECIMATION_MIN = 4
+
+    def __init__(self, read_audio: 'audio.ReadFn') -> None:
+        super().__init__(read_audio, threads=1)
+        self.zoom: 'Zoom | None' = None
+
+    def set_note(self, note: int) -> None:
+        bounds, self.cents = harmonic_axes(note)
+        # Only as far as the full transform would go
+        bounds = np.minimum(bounds, params.n_fft_out)
+
+        left, right = int(bounds[0, 0]), int(bounds[-1, 1])
+        if zoom_decimation(left, right) < self.DECIMATION_MIN:
+            self.zoom = None
+            self.harmonics = [
+                self.fft_out[left: right]
+                for left, right in bounds
+            ]
             self.fft()
+        else:
+            self.zoom = Zoom(left, right)
+            self.zoom.feed(self.fft_in)
+            self.zoom.fft()
+            self.harmonics = [
+                self.zoom.bins(left, right)
+                for left, right in bounds
+            ]
 
-        harms = []
-        for harm in self.harmonics:
-            harm = np.abs(harm)
-            yfmax = np.max(harm)
-            if yfmax > params.y_max:
-                harm *= params.y_max / yfmax
-            harms.append(harm)
+    def get_spectrum(self) -> 'AxisPair':
+        samples = self.shift_in()
+        if self.zoom is None:
+            if len(samples):
+                self.fft()
+            scale = 1
+        else:
+            if len(samples):
+                self.zoom.feed(samples)
+                self.zoom.fft()
+            # Decimation divides the sum by as many samples as it drops.
+            scale = self.zoom.decimation
 
-        return self.cents, harms
+        return self.cents, [
+            clip_harmonic(scale*np.abs(harm))
+            for harm in self.harmonics
+        ]
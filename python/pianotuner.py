@@ -1,5 +1,7 @@
 #!/usr/bin/env python3
 
+import argparse
+
 import audio
 import fft
 import params
@@ -7,6 +9,13 @@ import plot
 
 
 def main() -> None:
+    parser = argparse.ArgumentParser(description='Piano tuner spectrum view')
+    parser.add_argument(
+        '--zoom', action='store_true',
+        help='only transform the bands shown, by zoom FFT, to spare the CPU',
+    )
+    args = parser.parse_args()
+
     params.dump()
 
     note = params.n_a440
@@ -25,7 +34,7 @@ def main() -> None:
         plotter.set_note(note)
 
     with audio.init_audio() as read_audio:
-        fftw = fft.FFT(read_audio)
+        fftw = fft.ZoomFFT(read_audio) if args.zoom else fft.FFT(read_audio)
         plotter = plot.Plot(fftw.get_spectrum, change_note)
         change_note(0)
         plotter.run()